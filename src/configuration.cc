@@ -35,7 +35,15 @@ ParametersParser::ParametersParser(bopt::variables_map& vars) :
 Configuration ParametersParser::getConfiguration() {
 	Configuration conf;
 
-	if (vars.count(PR_KEY_INPUT)) {
+	InputParams input;
+	if (vars.count(PR_KEY_READ_BINARY)) {
+		input.binaryInput = vars[PR_KEY_READ_BINARY].as<string>();
+		ifstream dataStream(input.binaryInput.c_str());
+		if (!dataStream) {
+			string msg = (format("preprocessed file '%s' does not exist") % input.binaryInput).str();
+			throw invalid_configuration(msg);
+		}
+	} else if (vars.count(PR_KEY_INPUT)) {
 		conf.dataFile = vars[PR_KEY_INPUT].as<string>();
 		ifstream dataStream(conf.dataFile.c_str());
 		if (!dataStream) {
@@ -45,6 +53,76 @@ Configuration ParametersParser::getConfiguration() {
 	} else {
 		throw invalid_configuration("input file not specified");
 	}
+	if (vars.count(PR_KEY_WRITE_BINARY)) {
+		input.binaryOutput = vars[PR_KEY_WRITE_BINARY].as<string>();
+	}
+
+	int threads = vars[PR_KEY_THREADS].as<int>();
+	if (threads < 0) {
+		throw invalid_configuration("invalid number of threads: " + to_string(threads));
+	}
+	input.threads = threads;
+
+	int residentMemory = vars[PR_KEY_RESIDENT_MEMORY].as<int>();
+	if (residentMemory < 0) {
+		throw invalid_configuration("invalid resident memory: " + to_string(residentMemory));
+	}
+	if (residentMemory > 0 && input.binaryInput.empty()) {
+		throw invalid_configuration("out of core training requires preprocessed data (--read-binary)");
+	}
+	input.residentMemory = residentMemory;
+
+	int hashBits = vars[PR_KEY_HASH_BITS].as<int>();
+	if (hashBits < 0 || hashBits > MAX_HASH_BITS) {
+		throw invalid_configuration("invalid number of hash bits: " + to_string(hashBits));
+	}
+	input.hashBits = hashBits;
+
+	string precision = vars[PR_KEY_PRECISION].as<string>();
+	if (PRECISION_DOUBLE == precision) {
+		input.precision = DOUBLE_PRECISION;
+	} else if (PRECISION_MIXED == precision) {
+		input.precision = MIXED_PRECISION;
+	} else if (PRECISION_FLOAT == precision) {
+		input.precision = FLOAT_PRECISION;
+	} else if (PRECISION_HALF == precision) {
+		input.precision = HALF_PRECISION;
+	} else if (PRECISION_BFLOAT16 == precision) {
+		input.precision = BFLOAT16_PRECISION;
+	} else if (PRECISION_INT8 == precision) {
+		input.precision = INT8_PRECISION;
+	} else {
+		throw invalid_configuration("invalid precision: " + precision);
+	}
+
+	string indexEncoding = vars[PR_KEY_INDEX_ENCODING].as<string>();
+	if (INDEX_ENCODING_PLAIN == indexEncoding) {
+		input.indexEncoding = PLAIN_INDICES;
+	} else if (INDEX_ENCODING_DELTA == indexEncoding) {
+		input.indexEncoding = DELTA_INDICES;
+	} else {
+		throw invalid_configuration("invalid index encoding: " + indexEncoding);
+	}
+	conf.inputParams = input;
+
+	string matrixType = vars[PR_KEY_MATRIX_TYPE].as<string>();
+	if (MATRIX_TYPE_SPARSE == matrixType) {
+		conf.matrixType = SPARSE;
+	} else if (MATRIX_TYPE_DENSE == matrixType) {
+		conf.matrixType = DENSE;
+	} else if (MATRIX_TYPE_HYBRID == matrixType) {
+		conf.matrixType = HYBRID;
+	} else if (MATRIX_TYPE_BINARY == matrixType) {
+		conf.matrixType = BINARY;
+	} else if (MATRIX_TYPE_AUTO == matrixType) {
+		conf.matrixType = AUTO;
+	} else {
+		throw invalid_configuration("invalid matrix type: " + matrixType);
+	}
+	if ((conf.matrixType == DENSE || conf.matrixType == HYBRID || conf.matrixType == BINARY)
+			&& residentMemory > 0) {
+		throw invalid_configuration(matrixType + " matrices cannot be kept out of core");
+	}
 
   // SVM cross validation parameter setting
 	SearchRange range;
@@ -73,12 +151,26 @@ Configuration ParametersParser::getConfiguration() {
 	fvalue epochs = vars[PR_KEY_EPOCH].as<fvalue>();
 	fvalue margin = vars[PR_KEY_MARGIN].as<fvalue>();
 
+	ExpAccuracy expAccuracy;
+	string expName = vars[PR_KEY_EXP_ACCURACY].as<string>();
+	if (EXP_ACCURACY_EXACT == expName) {
+		expAccuracy = EXACT_EXP;
+	} else if (EXP_ACCURACY_PRECISE == expName) {
+		expAccuracy = PRECISE_EXP;
+	} else if (EXP_ACCURACY_FAST == expName) {
+		expAccuracy = FAST_EXP;
+	} else {
+		throw invalid_configuration("invalid exp accuracy: " + expName);
+	}
+
 	TrainParams params;
 	params.bias = bias;
 	params.drawNumber = drawNumber;
 	params.cache.size = cacheSize;
 	params.epochs = epochs;
 	params.margin = margin;
+	params.expAccuracy = expAccuracy;
+	params.threads = input.threads;
 	conf.trainingParams = params;
 
   // cross-validation inner and outer folds
@@ -97,3 +189,55 @@ Configuration ParametersParser::getConfiguration() {
 
 	return conf;
 }
+
+string getMatrixTypeName(MatrixType type) {
+	switch (type) {
+	case SPARSE:
+		return MATRIX_TYPE_SPARSE;
+	case DENSE:
+		return MATRIX_TYPE_DENSE;
+	case HYBRID:
+		return MATRIX_TYPE_HYBRID;
+	case BINARY:
+		return MATRIX_TYPE_BINARY;
+	default:
+		return MATRIX_TYPE_AUTO;
+	}
+}
+
+string getPrecisionName(Precision precision) {
+	switch (precision) {
+	case MIXED_PRECISION:
+		return PRECISION_MIXED;
+	case FLOAT_PRECISION:
+		return PRECISION_FLOAT;
+	case HALF_PRECISION:
+		return PRECISION_HALF;
+	case BFLOAT16_PRECISION:
+		return PRECISION_BFLOAT16;
+	case INT8_PRECISION:
+		return PRECISION_INT8;
+	default:
+		return PRECISION_DOUBLE;
+	}
+}
+
+string getIndexEncodingName(IndexEncoding encoding) {
+	switch (encoding) {
+	case DELTA_INDICES:
+		return INDEX_ENCODING_DELTA;
+	default:
+		return INDEX_ENCODING_PLAIN;
+	}
+}
+
+string getExpAccuracyName(ExpAccuracy accuracy) {
+	switch (accuracy) {
+	case PRECISE_EXP:
+		return EXP_ACCURACY_PRECISE;
+	case FAST_EXP:
+		return EXP_ACCURACY_FAST;
+	default:
+		return EXP_ACCURACY_EXACT;
+	}
+}
@@ -52,6 +52,15 @@ namespace bopt = boost::program_options;
 #define PR_EPOCH "epochs,P"
 #define PR_MARGIN "margin,M"
 #define PR_TEST_NAME "test-name,t"
+#define PR_THREADS "threads,T"
+#define PR_WRITE_BINARY "write-binary"
+#define PR_READ_BINARY "read-binary,R"
+#define PR_RESIDENT_MEMORY "resident-memory"
+#define PR_MATRIX_TYPE "matrix,m"
+#define PR_HASH_BITS "hash-bits,H"
+#define PR_PRECISION "precision,p"
+#define PR_INDEX_ENCODING "index-encoding,x"
+#define PR_EXP_ACCURACY "exp,e"
 
 #define PR_KEY_HELP "help"
 #define PR_KEY_C_LOW "c-low"
@@ -68,10 +77,39 @@ namespace bopt = boost::program_options;
 #define PR_KEY_EPOCH "epochs"
 #define PR_KEY_MARGIN "margin"
 #define PR_KEY_TEST_NAME "test-name"
+#define PR_KEY_THREADS "threads"
+#define PR_KEY_WRITE_BINARY "write-binary"
+#define PR_KEY_READ_BINARY "read-binary"
+#define PR_KEY_RESIDENT_MEMORY "resident-memory"
+#define PR_KEY_MATRIX_TYPE "matrix"
+#define PR_KEY_HASH_BITS "hash-bits"
+#define PR_KEY_PRECISION "precision"
+#define PR_KEY_INDEX_ENCODING "index-encoding"
+#define PR_KEY_EXP_ACCURACY "exp"
 
 #define BIAS_CALCULATION_NO "nobias"
 #define BIAS_CALCULATION_YES "yesbias"
 
+#define MATRIX_TYPE_SPARSE "sparse"
+#define MATRIX_TYPE_DENSE "dense"
+#define MATRIX_TYPE_HYBRID "hybrid"
+#define MATRIX_TYPE_BINARY "binary"
+#define MATRIX_TYPE_AUTO "auto"
+
+#define PRECISION_DOUBLE "double"
+#define PRECISION_MIXED "mixed"
+#define PRECISION_FLOAT "float"
+#define PRECISION_HALF "half"
+#define PRECISION_BFLOAT16 "bfloat16"
+#define PRECISION_INT8 "int8"
+
+#define INDEX_ENCODING_PLAIN "plain"
+#define INDEX_ENCODING_DELTA "delta"
+
+#define EXP_ACCURACY_EXACT "exact"
+#define EXP_ACCURACY_PRECISE "precise"
+#define EXP_ACCURACY_FAST "fast"
+
 class invalid_configuration: public exception {
 
 	string message;
@@ -84,11 +122,6 @@ public:
 
 };
 
-enum MatrixType {
-	SPARSE,
-	DENSE
-};
-
 enum ModelSelectionType {
 	GRID,
 	PATTERN
@@ -101,6 +134,7 @@ struct Configuration {
 
 	SearchRange searchRange;
 	TrainParams trainingParams;
+	InputParams inputParams;
 
 	struct CrossValidationParams {
 		quantity innerFolds;
@@ -123,5 +157,10 @@ public:
 	Configuration getConfiguration();
 };
 
+string getMatrixTypeName(MatrixType type);
+string getPrecisionName(Precision precision);
+string getIndexEncodingName(IndexEncoding encoding);
+string getExpAccuracyName(ExpAccuracy accuracy);
+
 
 #endif
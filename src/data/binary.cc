@@ -0,0 +1,309 @@
+/**************************************************************************
+ * This file is part of osvm, a Support Vector Machine solver.
+ * Copyright (C) 2012 Gabriella Melki (melkiga@vcu.edu), Vojislav Kecman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+#include "binary.h"
+
+inline uint64_t alignOffset(uint64_t offset) {
+	return (offset + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT * BINARY_ALIGNMENT;
+}
+
+OutOfCoreStorage::OutOfCoreStorage(MappedFile *file, BinaryHeader &header, size_t window) :
+		file(file),
+		window(window),
+		resident(0),
+		scattered(false) {
+	char *base = file->begin();
+	values = (fvalue*) (base + header.values);
+	features = (feature_id*) (base + header.features);
+	entries = header.entries;
+	rowLength = (quantity) (header.height > 0 ? header.entries / header.height : 1);
+
+	offsets = new offset_id[header.height];
+	memcpy(offsets, base + header.offsets, header.height * sizeof(offset_id));
+	lengths = new quantity[header.height];
+	memcpy(lengths, base + header.lengths, header.height * sizeof(quantity));
+	norms = new fvalue[header.height];
+	memcpy(norms, base + header.norms, header.height * sizeof(fvalue));
+}
+
+OutOfCoreStorage::~OutOfCoreStorage() {
+	delete [] offsets;
+	delete [] lengths;
+	delete [] norms;
+	delete file;
+}
+
+/*
+ * Rows stored close to each other are prefetched as one span. Blocks spread
+ * over the whole file (e.g. right after shuffling) are left to the pager and
+ * the entire window is dropped once they could have filled it.
+ */
+void OutOfCoreStorage::prefetch(size_t from, size_t to) {
+	offset_id first = offsets[from];
+	offset_id last = offsets[from];
+	for (size_t row = from; row < to; row++) {
+		first = min(first, offsets[row]);
+		last = max(last, offsets[row]);
+	}
+	last = (offset_id) min((uint64_t) last + 2 * rowLength, entries);
+
+	size_t rowBytes = sizeof(fvalue) + sizeof(feature_id);
+	if (last - first > SCATTERED_BLOCK_RATIO * (to - from) * rowLength) {
+		resident += (to - from) * rowLength * rowBytes;
+		scattered = true;
+	} else if (spans.empty() || first < spans.back().first || last > spans.back().second) {
+		file->prefetch((char*) (values + first), (char*) (values + last));
+		file->prefetch((char*) (features + first), (char*) (features + last));
+		spans.push_back(make_pair(first, last));
+		resident += (last - first) * rowBytes;
+	}
+
+	if (resident > window) {
+		if (scattered) {
+			release(0, (offset_id) entries);
+			spans.clear();
+			resident = 0;
+			scattered = false;
+		}
+		while (resident > window && spans.size() > 1) {
+			release(spans.front().first, spans.front().second);
+			resident -= (spans.front().second - spans.front().first) * rowBytes;
+			spans.pop_front();
+		}
+	}
+}
+
+void OutOfCoreStorage::release(offset_id first, offset_id last) {
+	file->release((char*) (values + first), (char*) (values + last));
+	file->release((char*) (features + first), (char*) (features + last));
+}
+
+DataSet BinaryDataSetFactory::createDataSet() {
+	// out of core samples are never modified, so the view can stay read only
+	MappedFile *file = new MappedFile(fileName, residentMemory == 0);
+	BinaryHeader header;
+	try {
+		if (file->size() < sizeof(BinaryHeader)) {
+			throw invalid_data_format("'" + fileName + "' is not a preprocessed data file");
+		}
+		memcpy(&header, file->begin(), sizeof(BinaryHeader));
+		validate(header, file->size());
+		validateRows(file, header);
+	} catch (...) {
+		delete file;
+		throw;
+	}
+
+	char *base = file->begin();
+	sfmatrix *matrix;
+	if (residentMemory > 0) {
+		OutOfCoreStorage *storage = new OutOfCoreStorage(file, header, residentMemory);
+		matrix = new sfmatrix((fvalue*) (base + header.values),
+				(feature_id*) (base + header.features), storage->offsets,
+				storage->lengths, header.height, header.width);
+		matrix->norms = storage->norms;
+		matrix->storage = storage;
+	} else {
+		matrix = new sfmatrix((fvalue*) (base + header.values),
+				(feature_id*) (base + header.features), (offset_id*) (base + header.offsets),
+				(quantity*) (base + header.lengths), header.height, header.width);
+		matrix->norms = (fvalue*) (base + header.norms);
+		matrix->storage = file;
+	}
+
+	label_id *labelPtr = (label_id*) (base + header.labels);
+	vector<label_id> labels(labelPtr, labelPtr + header.height);
+
+	map<label_id, string> labelNames;
+	const char *namePtr = base + header.labelNames;
+	const char *nameEnd = base + header.mappings;
+	for (label_id label = 0; label < header.labelNumber; label++) {
+		uint32_t length;
+		if (namePtr + sizeof(uint32_t) > nameEnd) {
+			delete matrix;
+			throw invalid_data_format("'" + fileName + "' is corrupted");
+		}
+		memcpy(&length, namePtr, sizeof(uint32_t));
+		namePtr += sizeof(uint32_t);
+		if (namePtr + length > nameEnd) {
+			delete matrix;
+			throw invalid_data_format("'" + fileName + "' is corrupted");
+		}
+		labelNames[label] = string(namePtr, length);
+		namePtr += length;
+	}
+
+	DataSet dataSet(labelNames, labels, matrix);
+	feature_id *mappingPtr = (feature_id*) (base + header.mappings);
+	dataSet.mappings = vector<feature_id>(mappingPtr, mappingPtr + header.mappingNumber);
+	return dataSet;
+}
+
+void BinaryDataSetFactory::validate(BinaryHeader &header, size_t size) {
+	if (memcmp(header.magic, BINARY_FORMAT_MAGIC, sizeof(BINARY_FORMAT_MAGIC)) != 0) {
+		throw invalid_data_format("'" + fileName + "' is not a preprocessed data file");
+	}
+	if (header.version != BINARY_FORMAT_VERSION) {
+		throw invalid_data_format((format("'%s' has unsupported format version %d")
+				% fileName % header.version).str());
+	}
+	if (header.byteOrder != BINARY_BYTE_ORDER
+			|| header.valueSize != sizeof(fvalue)
+			|| header.featureIdSize != sizeof(feature_id)
+			|| header.offsetSize != sizeof(offset_id)
+			|| header.labelIdSize != sizeof(label_id)) {
+		throw invalid_data_format("'" + fileName + "' was written by an incompatible build");
+	}
+	uint64_t sections[] = { header.values, header.features, header.offsets, header.lengths,
+			header.norms, header.labels, header.labelNames, header.mappings, header.size };
+	uint64_t sizes[] = { header.entries * sizeof(fvalue), header.entries * sizeof(feature_id),
+			header.height * sizeof(offset_id), header.height * sizeof(quantity),
+			header.height * sizeof(fvalue),
+			header.height * sizeof(label_id), 0, header.mappingNumber * sizeof(feature_id) };
+	for (size_t i = 0; i + 1 < sizeof(sections) / sizeof(uint64_t); i++) {
+		if (sections[i] % BINARY_ALIGNMENT != 0 || sections[i] + sizes[i] > sections[i + 1]) {
+			throw invalid_data_format("'" + fileName + "' is corrupted");
+		}
+	}
+	if (header.size != size) {
+		throw invalid_data_format("'" + fileName + "' is truncated");
+	}
+}
+
+/*
+ * Every row has to lie within the stored entries (starting aligned) and refer
+ * only to existing features. The ids of out of core samples are read once here
+ * and their pages are given back right away.
+ */
+void BinaryDataSetFactory::validateRows(MappedFile *file, BinaryHeader &header) {
+	char *base = file->begin();
+	offset_id *offsets = (offset_id*) (base + header.offsets);
+	quantity *lengths = (quantity*) (base + header.lengths);
+	feature_id *features = (feature_id*) (base + header.features);
+	for (sample_id row = 0; row < header.height; row++) {
+		if (offsets[row] % SPARSE_ROW_ALIGNMENT != 0 || padRow(lengths[row]) > header.entries
+				|| offsets[row] > header.entries - padRow(lengths[row])) {
+			throw runtime_error((format("'%s' is corrupted: row %d exceeds the stored entries")
+					% fileName % row).str());
+		}
+		feature_id *iptr = features + offsets[row];
+		for (quantity i = 0; i < lengths[row]; i++) {
+			if (iptr[i] >= header.width) {
+				throw runtime_error((format("'%s' is corrupted: feature %d of row %d exceeds the width")
+						% fileName % iptr[i] % row).str());
+			}
+		}
+	}
+	if (residentMemory > 0) {
+		file->release((char*) features, (char*) (features + header.entries));
+	}
+}
+
+void BinaryDataSetWriter::write(DataSet &dataSet) {
+	sfmatrix *matrix = dataSet.features;
+	MatrixEvaluator::computeNorms(matrix);
+
+	string labelNames;
+	map<label_id, string>::iterator it;
+	for (it = dataSet.labelNames.begin(); it != dataSet.labelNames.end(); it++) {
+		uint32_t length = (uint32_t) it->second.size();
+		labelNames.append((const char*) &length, sizeof(uint32_t));
+		labelNames.append(it->second);
+	}
+
+	BinaryHeader header = getLayout(dataSet, labelNames.size());
+
+	ofstream output(fileName.c_str(), ios::out | ios::binary | ios::trunc);
+	if (!output) {
+		throw runtime_error("cannot create file '" + fileName + "'");
+	}
+	output.write((const char*) &header, sizeof(BinaryHeader));
+
+	// padded rows are written one after another, so the stored arrays have no gaps
+	pad(output, header.values);
+	for (sample_id row = 0; row < matrix->height; row++) {
+		output.write((const char*) (matrix->values + matrix->offsets[row]),
+				padRow(matrix->lengths[row]) * sizeof(fvalue));
+	}
+	pad(output, header.features);
+	for (sample_id row = 0; row < matrix->height; row++) {
+		output.write((const char*) (matrix->features + matrix->offsets[row]),
+				padRow(matrix->lengths[row]) * sizeof(feature_id));
+	}
+	pad(output, header.offsets);
+	offset_id offset = 0;
+	for (sample_id row = 0; row < matrix->height; row++) {
+		output.write((const char*) &offset, sizeof(offset_id));
+		offset += padRow(matrix->lengths[row]);
+	}
+	pad(output, header.lengths);
+	output.write((const char*) matrix->lengths, matrix->height * sizeof(quantity));
+	pad(output, header.norms);
+	output.write((const char*) matrix->norms, matrix->height * sizeof(fvalue));
+	pad(output, header.labels);
+	output.write((const char*) dataSet.labels.data(), dataSet.labels.size() * sizeof(label_id));
+	pad(output, header.labelNames);
+	output.write(labelNames.data(), labelNames.size());
+	pad(output, header.mappings);
+	output.write((const char*) dataSet.mappings.data(), dataSet.mappings.size() * sizeof(feature_id));
+
+	if (!output) {
+		throw runtime_error("cannot write file '" + fileName + "'");
+	}
+}
+
+BinaryHeader BinaryDataSetWriter::getLayout(DataSet &dataSet, uint64_t labelNamesSize) {
+	sfmatrix *matrix = dataSet.features;
+
+	BinaryHeader header;
+	memset(&header, 0, sizeof(BinaryHeader));
+	memcpy(header.magic, BINARY_FORMAT_MAGIC, sizeof(BINARY_FORMAT_MAGIC));
+	header.version = BINARY_FORMAT_VERSION;
+	header.byteOrder = BINARY_BYTE_ORDER;
+	header.valueSize = sizeof(fvalue);
+	header.featureIdSize = sizeof(feature_id);
+	header.offsetSize = sizeof(offset_id);
+	header.labelIdSize = sizeof(label_id);
+
+	header.height = matrix->height;
+	header.width = matrix->width;
+	header.entries = 0;
+	for (sample_id row = 0; row < matrix->height; row++) {
+		header.entries += padRow(matrix->lengths[row]);
+	}
+	header.labelNumber = dataSet.labelNames.size();
+	header.mappingNumber = dataSet.mappings.size();
+
+	header.values = alignOffset(sizeof(BinaryHeader));
+	header.features = alignOffset(header.values + header.entries * sizeof(fvalue));
+	header.offsets = alignOffset(header.features + header.entries * sizeof(feature_id));
+	header.lengths = alignOffset(header.offsets + header.height * sizeof(offset_id));
+	header.norms = alignOffset(header.lengths + header.height * sizeof(quantity));
+	header.labels = alignOffset(header.norms + header.height * sizeof(fvalue));
+	header.labelNames = alignOffset(header.labels + header.height * sizeof(label_id));
+	header.mappings = alignOffset(header.labelNames + labelNamesSize);
+	header.size = header.mappings + header.mappingNumber * sizeof(feature_id);
+	return header;
+}
+
+void BinaryDataSetWriter::pad(ofstream &output, uint64_t offset) {
+	uint64_t position = (uint64_t) output.tellp();
+	for (; position < offset; position++) {
+		output.put(0);
+	}
+}
@@ -0,0 +1,152 @@
+/**************************************************************************
+ * This file is part of osvm, a Support Vector Machine solver.
+ * Copyright (C) 2012 Gabriella Melki (melkiga@vcu.edu), Vojislav Kecman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+#ifndef BINARY_H_
+#define BINARY_H_
+
+#include <cstdint>
+#include <deque>
+
+#include "dataset.h"
+#include "../math/matrix.h"
+
+#define BINARY_FORMAT_MAGIC "OSVMBIN"
+#define BINARY_FORMAT_VERSION 4
+#define BINARY_BYTE_ORDER 0x01020304
+#define BINARY_ALIGNMENT 64
+
+// blocks of rows spread wider than this many average rows are not prefetched
+#define SCATTERED_BLOCK_RATIO 4
+
+/**
+ * Header of the preprocessed data file. It is followed by the sections listed
+ * below, each one starting at an offset aligned to BINARY_ALIGNMENT, so that
+ * the arrays can be used in place once the file is mapped.
+ */
+struct BinaryHeader {
+
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+
+	uint32_t valueSize;
+	uint32_t featureIdSize;
+	uint32_t offsetSize;
+	uint32_t labelIdSize;
+
+	uint64_t height;
+	uint64_t width;
+	uint64_t entries;
+	uint64_t labelNumber;
+	uint64_t mappingNumber;
+
+	// section offsets (in bytes)
+	uint64_t values;
+	uint64_t features;
+	uint64_t offsets;
+	uint64_t lengths;
+	uint64_t norms;
+	uint64_t labels;
+	uint64_t labelNames;
+	uint64_t mappings;
+	uint64_t size;
+
+};
+
+/**
+ * Sample store for data that does not fit in memory. Values and feature ids
+ * stay in the read only mapped file and only a bounded window of them is kept
+ * resident: blocks of rows about to be read are prefetched and the spans read
+ * longest ago are released. Offsets, lengths and norms are copied to memory, so
+ * the samples can still be reordered by swapping.
+ */
+class OutOfCoreStorage: public MatrixStorage {
+
+	MappedFile *file;
+
+	fvalue *values;
+	feature_id *features;
+	uint64_t entries;
+	quantity rowLength;
+
+	size_t window;
+	size_t resident;
+	bool scattered;
+	deque<pair<offset_id, offset_id> > spans;
+
+	void release(offset_id first, offset_id last);
+
+public:
+	offset_id *offsets;
+	quantity *lengths;
+	fvalue *norms;
+
+	OutOfCoreStorage(MappedFile *file, BinaryHeader &header, size_t window);
+	~OutOfCoreStorage();
+
+	void prefetch(size_t from, size_t to);
+
+	bool isResident() {
+		return false;
+	}
+
+};
+
+/**
+ * Data set factory loading preprocessed (pruned and normalized) data. The file
+ * is mapped privately and serves directly as the sample store of the solver.
+ * With a limit on resident memory the samples are kept out of core.
+ */
+class BinaryDataSetFactory: public DataSetFactory {
+
+	string fileName;
+	size_t residentMemory;
+
+	void validate(BinaryHeader &header, size_t size);
+	void validateRows(MappedFile *file, BinaryHeader &header);
+
+public:
+	BinaryDataSetFactory(string fileName, size_t residentMemory = 0) :
+			fileName(fileName),
+			residentMemory(residentMemory) {
+	}
+
+	DataSet createDataSet();
+
+};
+
+/**
+ * Saves preprocessed data in the format read by BinaryDataSetFactory.
+ */
+class BinaryDataSetWriter {
+
+	string fileName;
+
+	BinaryHeader getLayout(DataSet &dataSet, uint64_t labelNamesSize);
+	void pad(ofstream &output, uint64_t offset);
+
+public:
+	BinaryDataSetWriter(string fileName) :
+			fileName(fileName) {
+	}
+
+	void write(DataSet &dataSet);
+
+};
+
+#endif
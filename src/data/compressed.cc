@@ -0,0 +1,222 @@
+/**************************************************************************
+ * This file is part of osvm, a Support Vector Machine solver.
+ * Copyright (C) 2012 Gabriella Melki (melkiga@vcu.edu), Vojislav Kecman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+#include "compressed.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+Compression detectCompression(const string &fileName) {
+	unsigned char magic[4] = { 0, 0, 0, 0 };
+	ifstream input(fileName.c_str(), ios::in | ios::binary);
+	input.read((char*) magic, sizeof(magic));
+
+	if (input.gcount() >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+		return GZIP_COMPRESSION;
+	}
+	if (input.gcount() == 4 && magic[0] == 0x28 && magic[1] == 0xb5
+			&& magic[2] == 0x2f && magic[3] == 0xfd) {
+		return ZSTD_COMPRESSION;
+	}
+	return NO_COMPRESSION;
+}
+
+class GzipDecoder: public Decoder {
+
+	gzFile file;
+	string fileName;
+
+public:
+	GzipDecoder(const string &fileName);
+	~GzipDecoder();
+
+	size_t read(char *buffer, size_t size);
+
+};
+
+#ifdef HAVE_ZSTD
+
+class ZstdDecoder: public Decoder {
+
+	FILE *file;
+	string fileName;
+
+	ZSTD_DStream *stream;
+	vector<char> input;
+	ZSTD_inBuffer inBuffer;
+	bool frameEnded;
+
+public:
+	ZstdDecoder(const string &fileName);
+	~ZstdDecoder();
+
+	size_t read(char *buffer, size_t size);
+
+};
+
+#endif
+
+GzipDecoder::GzipDecoder(const string &fileName) :
+		fileName(fileName) {
+	file = gzopen(fileName.c_str(), "rb");
+	if (file == NULL) {
+		throw runtime_error("cannot open input file '" + fileName + "'");
+	}
+	gzbuffer(file, 1 << 18);
+}
+
+GzipDecoder::~GzipDecoder() {
+	gzclose(file);
+}
+
+size_t GzipDecoder::read(char *buffer, size_t size) {
+	int length = gzread(file, buffer, (unsigned) size);
+	// a truncated stream ends like a complete one, only with an error recorded
+	int code = Z_OK;
+	const char *message = gzerror(file, &code);
+	if (length < 0 || (length == 0 && code != Z_OK)) {
+		throw runtime_error("cannot decompress '" + fileName + "': " + message);
+	}
+	return (size_t) length;
+}
+
+#ifdef HAVE_ZSTD
+
+ZstdDecoder::ZstdDecoder(const string &fileName) :
+		fileName(fileName),
+		input(ZSTD_DStreamInSize()),
+		frameEnded(true) {
+	file = fopen(fileName.c_str(), "rb");
+	if (file == NULL) {
+		throw runtime_error("cannot open input file '" + fileName + "'");
+	}
+	stream = ZSTD_createDStream();
+	ZSTD_initDStream(stream);
+	inBuffer.src = input.data();
+	inBuffer.size = 0;
+	inBuffer.pos = 0;
+}
+
+ZstdDecoder::~ZstdDecoder() {
+	ZSTD_freeDStream(stream);
+	fclose(file);
+}
+
+size_t ZstdDecoder::read(char *buffer, size_t size) {
+	ZSTD_outBuffer outBuffer = { buffer, size, 0 };
+	while (outBuffer.pos < outBuffer.size) {
+		if (inBuffer.pos == inBuffer.size) {
+			inBuffer.size = fread(input.data(), 1, input.size(), file);
+			inBuffer.pos = 0;
+			if (inBuffer.size == 0) {
+				if (ferror(file) || !frameEnded) {
+					throw runtime_error("cannot decompress '" + fileName + "': truncated data");
+				}
+				break;
+			}
+		}
+		size_t result = ZSTD_decompressStream(stream, &outBuffer, &inBuffer);
+		if (ZSTD_isError(result)) {
+			throw runtime_error("cannot decompress '" + fileName + "': " + ZSTD_getErrorName(result));
+		}
+		frameEnded = result == 0;
+	}
+	return outBuffer.pos;
+}
+
+#endif
+
+DecompressingReader::DecompressingReader(const string &fileName, Compression compression) :
+		decoder(NULL),
+		finished(false),
+		cancelled(false) {
+	if (compression == GZIP_COMPRESSION) {
+		decoder = new GzipDecoder(fileName);
+	} else if (compression == ZSTD_COMPRESSION) {
+#ifdef HAVE_ZSTD
+		decoder = new ZstdDecoder(fileName);
+#else
+		throw runtime_error("'" + fileName + "' is zstd compressed, which is not supported by this build");
+#endif
+	} else {
+		throw runtime_error("'" + fileName + "' is not compressed");
+	}
+	worker = thread(&DecompressingReader::run, this);
+}
+
+DecompressingReader::~DecompressingReader() {
+	{
+		lock_guard<mutex> guard(lock);
+		cancelled = true;
+	}
+	changed.notify_all();
+	worker.join();
+	delete decoder;
+}
+
+void DecompressingReader::run() {
+	try {
+		while (true) {
+			vector<char> block(DECOMPRESSED_BLOCK_SIZE);
+			block.resize(decoder->read(block.data(), block.size()));
+
+			unique_lock<mutex> guard(lock);
+			changed.wait(guard, [this]() {
+				return cancelled || blocks.size() < DECOMPRESSED_QUEUE_LENGTH;
+			});
+			if (cancelled) {
+				return;
+			}
+			if (block.empty()) {
+				finished = true;
+				changed.notify_all();
+				return;
+			}
+			blocks.push_back(move(block));
+			changed.notify_all();
+		}
+	} catch (...) {
+		lock_guard<mutex> guard(lock);
+		error = current_exception();
+		finished = true;
+		changed.notify_all();
+	}
+}
+
+bool DecompressingReader::next(vector<char> &block) {
+	unique_lock<mutex> guard(lock);
+	changed.wait(guard, [this]() {
+		return finished || !blocks.empty();
+	});
+	if (!blocks.empty()) {
+		block = move(blocks.front());
+		blocks.pop_front();
+		changed.notify_all();
+		return true;
+	}
+	if (error) {
+		rethrow_exception(error);
+	}
+	block.clear();
+	return false;
+}
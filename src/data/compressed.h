@@ -0,0 +1,89 @@
+/**************************************************************************
+ * This file is part of osvm, a Support Vector Machine solver.
+ * Copyright (C) 2012 Gabriella Melki (melkiga@vcu.edu), Vojislav Kecman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+#ifndef COMPRESSED_H_
+#define COMPRESSED_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+
+using namespace std;
+
+#define DECOMPRESSED_BLOCK_SIZE (4 << 20)
+#define DECOMPRESSED_QUEUE_LENGTH 4
+
+enum Compression {
+	NO_COMPRESSION, GZIP_COMPRESSION, ZSTD_COMPRESSION
+};
+
+/**
+ * Recognizes the compression of the file by its magic number.
+ */
+Compression detectCompression(const string &fileName);
+
+/**
+ * Source of decompressed data (implemented for every supported compression).
+ */
+class Decoder {
+
+public:
+	virtual ~Decoder() {}
+
+	// fills at most 'size' bytes of 'buffer', returns 0 at the end of data
+	virtual size_t read(char *buffer, size_t size) = 0;
+
+};
+
+/**
+ * Decompresses a file on a separate thread. Blocks of decompressed data are
+ * passed through a bounded queue, so decompression overlaps with parsing.
+ */
+class DecompressingReader {
+
+	Decoder *decoder;
+
+	deque<vector<char> > blocks;
+	bool finished;
+	bool cancelled;
+	exception_ptr error;
+
+	mutex lock;
+	condition_variable changed;
+	thread worker;
+
+	void run();
+
+	DecompressingReader(const DecompressingReader&);
+	DecompressingReader& operator=(const DecompressingReader&);
+
+public:
+	DecompressingReader(const string &fileName, Compression compression);
+	~DecompressingReader();
+
+	// returns false (and an empty block) once all data has been read
+	bool next(vector<char> &block);
+
+};
+
+#endif
@@ -18,53 +18,341 @@
 
 #include "dataset.h"
 
-DataSet SparseFormatDataSetFactory::createDataSet() {
-	map<string, label_id> labelIds;
-	list<label_id> sampleLabels;
-	list<map<feature_id, fvalue> > sampleFeatures;
+#include <cctype>
+#include <charconv>
+#include <cstdint>
 
-	label_id labelCounter = 0;
+invalid_data_format::invalid_data_format(string message) : message(message) {
+}
+
+invalid_data_format::~invalid_data_format() throw () {
+}
+
+const char* invalid_data_format::what() const throw() {
+	return message.c_str();
+}
+
+inline bool isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
 
-	while (!input.eof()) {
-		string line;
-		getline(input, line);
-		stringstream lineStream(line);
-		if (!line.empty()) {
+inline const char* skipBlanks(const char *ptr, const char *end) {
+	while (ptr < end && isBlank(*ptr)) {
+		ptr++;
+	}
+	return ptr;
+}
+
+void FeatureStatistics::merge(const FeatureStatistics &other) {
+	if (other.counts.size() > counts.size()) {
+		mins.resize(other.counts.size(), 0.0);
+		maxs.resize(other.counts.size(), 0.0);
+		counts.resize(other.counts.size(), 0);
+	}
+	for (feature_id feature = 0; feature < other.counts.size(); feature++) {
+		if (other.counts[feature] == 0) {
+			continue;
+		}
+		if (counts[feature] == 0) {
+			mins[feature] = other.mins[feature];
+			maxs[feature] = other.maxs[feature];
+		} else {
+			mins[feature] = min(mins[feature], other.mins[feature]);
+			maxs[feature] = max(maxs[feature], other.maxs[feature]);
+		}
+		counts[feature] += other.counts[feature];
+	}
+}
+
+/*
+ * The arrays are sized once for the width of the matrix.
+ */
+void FeatureStatistics::collect(sfmatrix *matrix) {
+	mins.assign(matrix->width, 0.0);
+	maxs.assign(matrix->width, 0.0);
+	counts.assign(matrix->width, 0);
+	for (sample_id row = 0; row < matrix->height; row++) {
+		offset_id offset = matrix->offsets[row];
+		offset_id end = offset + matrix->lengths[row];
+		for (; offset < end; offset++) {
+			add(matrix->features[offset], matrix->values[offset]);
+		}
+	}
+}
+
+DataFormat detectFormat(const string &fileName) {
+	string name = fileName;
+	transform(name.begin(), name.end(), name.begin(), ::tolower);
+	const char *compressed[] = { ".gz", ".zst", ".zstd" };
+	for (size_t i = 0; i < sizeof(compressed) / sizeof(compressed[0]); i++) {
+		size_t length = strlen(compressed[i]);
+		if (name.size() > length && name.compare(name.size() - length, length, compressed[i]) == 0) {
+			name.resize(name.size() - length);
+			break;
+		}
+	}
+	if (name.size() > 4 && name.compare(name.size() - 4, 4, ".csv") == 0) {
+		return CSV_FORMAT;
+	}
+	return LIBSVM_FORMAT;
+}
+
+SparseFormatParser::SparseFormatParser(quantity firstLine, DataFormat format, quantity hashBits) :
+		labelCounter(0),
+		line(firstLine),
+		dataFormat(format),
+		hashBits(hashBits) {
+}
+
+/*
+ * Every feature is written as 'id:value' (or preceded by a comma in CSV), so
+ * the number of separators bounds the number of stored entries and the number
+ * of line breaks bounds the number of rows. Every row may need padding and the
+ * total stays aligned, so that slices of consecutive chunks start aligned too.
+ */
+SparseFormatBounds SparseFormatParser::measure(const char *begin, const char *end, DataFormat format) {
+	SparseFormatBounds bounds;
+	bounds.rows = (quantity) count(begin, end, '\n') + 1;
+	bounds.entries = padRow((offset_id) count(begin, end, format == CSV_FORMAT ? ',' : ':')
+			+ (offset_id) bounds.rows * (SPARSE_ROW_ALIGNMENT - 1));
+	return bounds;
+}
+
+void SparseFormatParser::parse(const char *begin, const char *end, SparseFragment &fragment) {
+	const char *ptr = begin;
+	while (ptr < end) {
+		line++;
+		ptr = skipBlanks(ptr, end);
+		if (ptr < end && *ptr != '\n' && line == 1 && dataFormat == CSV_FORMAT && isHeader(ptr, end)) {
+			ptr = find(ptr, end, '\n');
+		} else if (ptr < end && *ptr != '\n') {
 			// read label
-			string label;
-			lineStream >> label;
-			if (!labelIds.count(label)) {
-				labelIds[label] = labelCounter++;
-			}
-			sampleLabels.push_back(labelIds[label]);
+			ptr = readLabel(ptr, end, fragment.labels[fragment.rows]);
+			fragment.offsets[fragment.rows] = fragment.entries;
+			fragment.rows++;
 
 			// read features
-			sampleFeatures.push_back(readFeatures(lineStream));
+			if (dataFormat == CSV_FORMAT) {
+				ptr = readColumns(ptr, end, fragment);
+			} else {
+				ptr = readFeatures(ptr, end, fragment);
+			}
+		}
+		if (ptr < end) {
+			ptr++;
 		}
 	}
+}
 
-	map<label_id, string> labels = getLabelMap(labelIds);
+/*
+ * The first line of a CSV file is a header if any of its value columns is not
+ * a number. Labels may be names, so the first column is not looked at.
+ */
+bool SparseFormatParser::isHeader(const char *ptr, const char *end) {
+	const char *lineEnd = find(ptr, end, '\n');
+	ptr = find(ptr, lineEnd, ',');
+	while (ptr < lineEnd) {
+		ptr = skipBlanks(ptr + 1, lineEnd);
+		if (ptr < lineEnd && *ptr == '+') {
+			ptr++;
+		}
 
-	return DataSet(labels, sampleLabels, sampleFeatures);
+		fvalue value;
+		from_chars_result res = from_chars(ptr, lineEnd, value);
+		if (res.ec != errc()) {
+			return true;
+		}
+		ptr = skipBlanks(res.ptr, lineEnd);
+		if (ptr < lineEnd && *ptr != ',') {
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* SparseFormatParser::readLabel(const char *ptr, const char *end, label_id &label) {
+	const char *start = ptr;
+	char separator = dataFormat == CSV_FORMAT ? ',' : ' ';
+	while (ptr < end && *ptr != '\n' && *ptr != separator && !isBlank(*ptr)) {
+		ptr++;
+	}
+	string name(start, ptr);
+	map<string, label_id>::iterator it = labelIds.find(name);
+	if (it == labelIds.end()) {
+		it = labelIds.insert(make_pair(name, labelCounter++)).first;
+	}
+	label = it->second;
+	return ptr;
+}
+
+const char* SparseFormatParser::readFeatures(const char *ptr, const char *end, SparseFragment &fragment) {
+	feature_id *features = fragment.features + fragment.entries;
+	fvalue *values = fragment.values + fragment.entries;
+	quantity length = 0;
+	bool sorted = true;
+
+	ptr = skipBlanks(ptr, end);
+	while (ptr < end && *ptr != '\n') {
+		unsigned long featureId;
+		from_chars_result res = from_chars(ptr, end, featureId);
+		if (res.ec != errc() || res.ptr == end || *res.ptr != ':') {
+			fail("expected 'feature:value' pair");
+		}
+		if (hashBits == 0 && featureId >= INVALID_FEATURE_ID) {
+			fail("feature id out of range");
+		}
+		ptr = res.ptr + 1;
+		if (ptr < end && *ptr == '+') {
+			ptr++;
+		}
+
+		fvalue value;
+		res = from_chars(ptr, end, value);
+		if (res.ec != errc() || (res.ptr < end && *res.ptr != '\n' && !isBlank(*res.ptr))) {
+			fail("invalid feature value");
+		}
+		ptr = skipBlanks(res.ptr, end);
+
+		if (value != 0.0) {
+			if (hashBits > 0) {
+				featureId = hashFeature(featureId, value);
+			}
+			if (length > 0 && featureId <= features[length - 1]) {
+				sorted = false;
+			}
+			features[length] = (feature_id) featureId;
+			values[length] = value;
+			fragment.maxFeature = max(fragment.maxFeature, (feature_id) featureId);
+			length++;
+		}
+	}
+
+	finishRow(features, values, length, sorted, fragment);
+	return ptr;
 }
 
-map<feature_id, fvalue> SparseFormatDataSetFactory::readFeatures(
-		istream& lineStream) {
-	map<feature_id, fvalue> features;
-	while (!lineStream.eof()) {
-		feature_id featureId;
-		char delim;
+const char* SparseFormatParser::readColumns(const char *ptr, const char *end, SparseFragment &fragment) {
+	feature_id *features = fragment.features + fragment.entries;
+	fvalue *values = fragment.values + fragment.entries;
+	quantity length = 0;
+	bool sorted = true;
+	unsigned long column = 0;
+
+	ptr = skipBlanks(ptr, end);
+	while (ptr < end && *ptr != '\n') {
+		if (*ptr != ',') {
+			fail("expected ',' before value");
+		}
+		ptr = skipBlanks(ptr + 1, end);
+		if (++column >= INVALID_FEATURE_ID) {
+			fail("too many columns");
+		}
+		if (ptr < end && *ptr == '+') {
+			ptr++;
+		}
+
 		fvalue value;
-		lineStream >> featureId >> delim >> value;
+		from_chars_result res = from_chars(ptr, end, value);
+		if (res.ec != errc()) {
+			fail("invalid feature value");
+		}
+		ptr = skipBlanks(res.ptr, end);
+		if (ptr < end && *ptr != ',' && *ptr != '\n') {
+			fail("invalid feature value");
+		}
+
 		if (value != 0.0) {
-			features[featureId] = value;
+			feature_id feature = (feature_id) column;
+			if (hashBits > 0) {
+				feature = hashFeature(column, value);
+				sorted = sorted && (length == 0 || feature > features[length - 1]);
+			}
+			features[length] = feature;
+			values[length] = value;
+			fragment.maxFeature = max(fragment.maxFeature, feature);
+			length++;
+		}
+	}
+
+	finishRow(features, values, length, sorted, fragment);
+	return ptr;
+}
+
+/*
+ * Sorts the row if needed, pads it and updates the feature statistics. Hashed
+ * ids are spread over up to 2^hashBits columns, so their statistics are not
+ * kept per chunk (see SparseFormatDataSetFactory::createDataSet).
+ */
+void SparseFormatParser::finishRow(feature_id *features, fvalue *values, quantity length, bool sorted, SparseFragment &fragment) {
+	if (!sorted) {
+		sortRow(features, values, length);
+	}
+	if (hashBits == 0) {
+		for (quantity i = 0; i < length; i++) {
+			fragment.statistics.add(features[i], values[i]);
+		}
+	}
+	quantity padded = (quantity) padRow(length);
+	for (quantity i = length; i < padded; i++) {
+		features[i] = 0;
+		values[i] = 0.0;
+	}
+	fragment.lengths[fragment.rows - 1] = length;
+	fragment.entries += padded;
+}
+
+/*
+ * Maps the original feature id to one of 2^hashBits columns. The id is mixed
+ * with the finalizer of MurmurHash3: the low bits select the column and the
+ * highest bit the sign of the value, so that collisions cancel out on average.
+ */
+feature_id SparseFormatParser::hashFeature(unsigned long feature, fvalue &value) {
+	uint64_t hash = feature;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	if (hash >> 63) {
+		value = -value;
+	}
+	return (feature_id) (hash & ((1ULL << hashBits) - 1));
+}
+
+/*
+ * Rows in libSVM files are supposed to be sorted already. For the remaining
+ * ones the features are ordered and, for repeated ids, the last value is kept
+ * (values of colliding hashed features are summed instead).
+ */
+void SparseFormatParser::sortRow(feature_id *features, fvalue *values, quantity &length) {
+	vector<pair<feature_id, fvalue> > row(length);
+	for (quantity i = 0; i < length; i++) {
+		row[i] = make_pair(features[i], values[i]);
+	}
+	stable_sort(row.begin(), row.end(),
+			[](const pair<feature_id, fvalue> &a, const pair<feature_id, fvalue> &b) {
+		return a.first < b.first;
+	});
+	quantity unique = 0;
+	for (quantity i = 0; i < length; i++) {
+		if (unique > 0 && features[unique - 1] == row[i].first) {
+			unique--;
+			if (hashBits > 0) {
+				row[i].second += values[unique];
+			}
 		}
+		features[unique] = row[i].first;
+		values[unique] = row[i].second;
+		unique++;
 	}
-	return features;
+	length = unique;
+}
+
+void SparseFormatParser::fail(string reason) {
+	throw invalid_data_format((format("line %d: %s") % line % reason).str());
 }
 
-map<label_id, string> SparseFormatDataSetFactory::getLabelMap(
-		map<string, label_id> &labelIds) {
+map<label_id, string> SparseFormatParser::getLabelMap() {
 	map<label_id, string> labels;
 	map<string, label_id>::iterator it;
 	for (it = labelIds.begin(); it != labelIds.end(); it++) {
@@ -72,3 +360,295 @@ map<label_id, string> SparseFormatDataSetFactory::getLabelMap(
 	}
 	return labels;
 }
+
+/*
+ * Runs 'task' for every chunk, each one on its own thread. The first exception
+ * thrown by any of the tasks is passed on to the caller.
+ */
+template<typename Task>
+void forEachChunk(vector<SparseChunk> &chunks, Task task) {
+	if (chunks.size() == 1) {
+		task(chunks[0]);
+		return;
+	}
+
+	vector<exception_ptr> errors(chunks.size());
+	vector<thread> workers;
+	for (size_t i = 0; i < chunks.size(); i++) {
+		workers.push_back(thread([&chunks, &errors, &task, i]() {
+			try {
+				task(chunks[i]);
+			} catch (...) {
+				errors[i] = current_exception();
+			}
+		}));
+	}
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+	for (size_t i = 0; i < errors.size(); i++) {
+		if (errors[i]) {
+			rethrow_exception(errors[i]);
+		}
+	}
+}
+
+/*
+ * Replaces 'array' with a copy of 'size' elements, 'used' of them are kept.
+ */
+template<typename T>
+void resizeArray(T *&array, offset_id used, offset_id size) {
+	T *resized = new T[size];
+	copy(array, array + used, resized);
+	delete [] array;
+	array = resized;
+}
+
+/*
+ * Same as resizeArray, for the aligned arrays of values and feature ids.
+ */
+template<typename T>
+void resizeEntries(T *&array, offset_id used, offset_id size) {
+	T *resized = (T*) allocateEntries(size, sizeof(T));
+	if (used > 0) {
+		memcpy(resized, array, used * sizeof(T));
+	}
+	freeEntries(array);
+	array = resized;
+}
+
+DataSet SparseFormatDataSetFactory::createDataSet() {
+	SparseFragment result;
+	map<label_id, string> labelNames;
+
+	Compression compression = detectCompression(fileName);
+	if (compression == NO_COMPRESSION) {
+		MappedFile file(fileName);
+		vector<SparseChunk> chunks = splitChunks(file, getThreadNumber(file.size()));
+		parseChunks(chunks, result);
+		labelNames = mergeChunks(chunks, result);
+	} else {
+		labelNames = parseStream(compression, result);
+	}
+
+	vector<label_id> labels(result.labels, result.labels + result.rows);
+	delete [] result.labels;
+
+	quantity width = result.entries > 0 ? result.maxFeature + 1 : 0;
+	sfmatrix *matrix = new sfmatrix(result.values, result.features,
+			result.offsets, result.lengths, result.rows, width);
+
+	DataSet dataSet(labelNames, labels, matrix);
+	if (params.hashBits > 0) {
+		// collected once for all the chunks, in arrays bounded by the hashed width
+		dataSet.statistics.collect(matrix);
+	} else {
+		dataSet.statistics = result.statistics;
+	}
+	return dataSet;
+}
+
+quantity SparseFormatDataSetFactory::getThreadNumber(size_t fileSize) {
+	quantity threads = params.threads;
+	if (threads == 0) {
+		threads = max(thread::hardware_concurrency(), 1u);
+	}
+	quantity chunks = (quantity) max(fileSize / MIN_CHUNK_SIZE, (size_t) 1);
+	return min(threads, chunks);
+}
+
+vector<SparseChunk> SparseFormatDataSetFactory::splitChunks(const MappedFile &file, quantity number) {
+	vector<SparseChunk> chunks(number);
+	const char *start = file.begin();
+	const char *end = file.end();
+	for (quantity i = 0; i < number; i++) {
+		const char *split = end;
+		if (i + 1 < number) {
+			split = max((const char*) file.begin() + file.size() / number * (i + 1), start);
+			split = find(split, end, '\n');
+			if (split < end) {
+				split++;
+			}
+		}
+		chunks[i].begin = start;
+		chunks[i].end = split;
+		start = split;
+	}
+	return chunks;
+}
+
+/*
+ * Every chunk is parsed straight into its own slice of the final arrays. Slices
+ * are sized by the chunk bounds, so they may leave gaps that are removed later.
+ */
+void SparseFormatDataSetFactory::parseChunks(vector<SparseChunk> &chunks, SparseFragment &result) {
+	DataFormat format = dataFormat;
+	quantity hashBits = params.hashBits;
+	forEachChunk(chunks, [format](SparseChunk &chunk) {
+		chunk.bounds = SparseFormatParser::measure(chunk.begin, chunk.end, format);
+	});
+
+	quantity lines = 0;
+	quantity rows = 0;
+	offset_id entries = 0;
+	vector<SparseChunk>::iterator it;
+	for (it = chunks.begin(); it != chunks.end(); it++) {
+		it->firstLine = lines;
+		it->firstRow = rows;
+		it->firstEntry = entries;
+		lines += it->bounds.rows - 1;
+		rows += it->bounds.rows;
+		entries += it->bounds.entries;
+	}
+
+	result.values = (fvalue*) allocateEntries(entries, sizeof(fvalue));
+	result.features = (feature_id*) allocateEntries(entries, sizeof(feature_id));
+	result.offsets = new offset_id[rows];
+	result.lengths = new quantity[rows];
+	result.labels = new label_id[rows];
+	result.rows = 0;
+	result.entries = 0;
+	result.maxFeature = 0;
+
+	try {
+		forEachChunk(chunks, [&result, format, hashBits](SparseChunk &chunk) {
+			SparseFragment &fragment = chunk.fragment;
+			fragment.values = result.values;
+			fragment.features = result.features;
+			fragment.offsets = result.offsets + chunk.firstRow;
+			fragment.lengths = result.lengths + chunk.firstRow;
+			fragment.labels = result.labels + chunk.firstRow;
+			fragment.rows = 0;
+			fragment.entries = chunk.firstEntry;
+			fragment.maxFeature = 0;
+
+			SparseFormatParser parser(chunk.firstLine, format, hashBits);
+			parser.parse(chunk.begin, chunk.end, fragment);
+			chunk.labelNames = parser.getLabelMap();
+		});
+	} catch (...) {
+		freeEntries(result.values);
+		freeEntries(result.features);
+		delete [] result.offsets;
+		delete [] result.lengths;
+		delete [] result.labels;
+		throw;
+	}
+}
+
+/*
+ * Translates chunk label ids to global ones, numbering the labels in the order
+ * of their first appearance in the file, and closes the gaps between slices.
+ */
+map<label_id, string> SparseFormatDataSetFactory::mergeChunks(vector<SparseChunk> &chunks, SparseFragment &result) {
+	map<string, label_id> labelIds;
+	label_id labelCounter = 0;
+
+	vector<SparseChunk>::iterator it;
+	for (it = chunks.begin(); it != chunks.end(); it++) {
+		SparseFragment &fragment = it->fragment;
+
+		vector<label_id> globalIds(it->labelNames.size());
+		map<label_id, string>::iterator lit;
+		for (lit = it->labelNames.begin(); lit != it->labelNames.end(); lit++) {
+			if (!labelIds.count(lit->second)) {
+				labelIds[lit->second] = labelCounter++;
+			}
+			globalIds[lit->first] = labelIds[lit->second];
+		}
+
+		offset_id entries = fragment.entries - it->firstEntry;
+		offset_id shift = it->firstEntry - result.entries;
+		if (shift > 0) {
+			memmove(result.values + result.entries, result.values + it->firstEntry, entries * sizeof(fvalue));
+			memmove(result.features + result.entries, result.features + it->firstEntry, entries * sizeof(feature_id));
+		}
+		for (sample_id row = 0; row < fragment.rows; row++) {
+			result.offsets[result.rows + row] = fragment.offsets[row] - shift;
+			result.lengths[result.rows + row] = fragment.lengths[row];
+			result.labels[result.rows + row] = globalIds[fragment.labels[row]];
+		}
+
+		result.rows += fragment.rows;
+		result.entries += entries;
+		result.maxFeature = max(result.maxFeature, fragment.maxFeature);
+		result.statistics.merge(fragment.statistics);
+	}
+
+	map<label_id, string> labelNames;
+	map<string, label_id>::iterator lit;
+	for (lit = labelIds.begin(); lit != labelIds.end(); lit++) {
+		labelNames[lit->second] = lit->first;
+	}
+	return labelNames;
+}
+
+/*
+ * Compressed data is parsed block by block while the next blocks are being
+ * decompressed. The line split between two blocks is carried over to the next
+ * one and the arrays grow as the samples are read.
+ */
+map<label_id, string> SparseFormatDataSetFactory::parseStream(Compression compression, SparseFragment &result) {
+	result.values = NULL;
+	result.features = NULL;
+	result.offsets = NULL;
+	result.lengths = NULL;
+	result.labels = NULL;
+	result.rows = 0;
+	result.entries = 0;
+	result.maxFeature = 0;
+
+	quantity rowCapacity = 0;
+	offset_id entryCapacity = 0;
+	SparseFormatParser parser(0, dataFormat, params.hashBits);
+	try {
+		DecompressingReader reader(fileName, compression);
+		vector<char> text;
+		vector<char> block;
+		bool more = true;
+		while (more) {
+			more = reader.next(block);
+			if (text.empty()) {
+				text.swap(block);
+			} else {
+				text.insert(text.end(), block.begin(), block.end());
+			}
+
+			const char *begin = text.data();
+			const char *end = begin + text.size();
+			if (more) {
+				while (end > begin && *(end - 1) != '\n') {
+					end--;
+				}
+				if (end == begin) {
+					continue;
+				}
+			}
+
+			// capacities are at least doubled, so that growing is amortized
+			SparseFormatBounds bounds = SparseFormatParser::measure(begin, end, dataFormat);
+			if (result.rows + bounds.rows > rowCapacity) {
+				rowCapacity = max(result.rows + bounds.rows, 2 * rowCapacity);
+				resizeArray(result.offsets, result.rows, rowCapacity);
+				resizeArray(result.lengths, result.rows, rowCapacity);
+				resizeArray(result.labels, result.rows, rowCapacity);
+			}
+			if (result.entries + bounds.entries > entryCapacity) {
+				entryCapacity = max(result.entries + bounds.entries, 2 * entryCapacity);
+				resizeEntries(result.values, result.entries, entryCapacity);
+				resizeEntries(result.features, result.entries, entryCapacity);
+			}
+
+			parser.parse(begin, end, result);
+			text.erase(text.begin(), text.begin() + (end - begin));
+		}
+	} catch (...) {
+		freeEntries(result.values);
+		freeEntries(result.features);
+		delete [] result.offsets;
+		delete [] result.lengths;
+		delete [] result.labels;
+		throw;
+	}
+	return parser.getLabelMap();
+}
@@ -29,20 +29,152 @@
 #include <map>
 #include <list>
 #include <vector>
+#include <algorithm>
+#include <thread>
+#include <exception>
+#include <cstring>
+#include <cmath>
 
 #include "../math/numeric.h"
+#include "../math/matrix_sparse.h"
+#include "../logging/log.h"
+#include "mapped_file.h"
+#include "compressed.h"
+
+#define DEFAULT_READ_THREADS 0
+#define MIN_CHUNK_SIZE (1 << 20)
+#define DEFAULT_RESIDENT_MEMORY 0
+#define DEFAULT_HASH_BITS 0
+// hashed feature ids have to stay below INVALID_FEATURE_ID
+#define MAX_HASH_BITS 31
+
+class invalid_data_format: public exception {
+
+	string message;
+
+public:
+	invalid_data_format(string message);
+	virtual ~invalid_data_format() throw();
+
+	virtual const char* what() const throw();
+
+};
+
+/**
+ * Layout of the text data: libSVM ('label id:value ...') or CSV ('label,value,...',
+ * value in column i becomes feature i).
+ */
+enum DataFormat {
+	LIBSVM_FORMAT, CSV_FORMAT
+};
+
+/**
+ * Recognizes CSV files by their extension ('.csv', possibly followed by the
+ * extension of the compression).
+ */
+DataFormat detectFormat(const string &fileName);
+
+/**
+ * Options controlling how the data file is read.
+ */
+struct InputParams {
+
+	// 0 stands for all available cores
+	quantity threads;
+
+	// preprocessed data files to load from / save to (empty if not used)
+	string binaryInput;
+	string binaryOutput;
+
+	// memory for preprocessed samples in MB, 0 keeps all of them resident
+	quantity residentMemory;
+
+	// feature ids are hashed into 2^hashBits columns, 0 keeps the original ids
+	quantity hashBits;
+
+	// precision the samples are kept in while training
+	Precision precision;
+
+	// encoding of the feature ids while training
+	IndexEncoding indexEncoding;
+
+	InputParams() :
+			threads(DEFAULT_READ_THREADS),
+			residentMemory(DEFAULT_RESIDENT_MEMORY),
+			hashBits(DEFAULT_HASH_BITS),
+			precision(DOUBLE_PRECISION),
+			indexEncoding(PLAIN_INDICES) {
+	}
+
+};
+
+/**
+ * Minimum, maximum and number of the stored (nonzero) values of every feature.
+ */
+struct FeatureStatistics {
+
+	vector<fvalue> mins;
+	vector<fvalue> maxs;
+	vector<quantity> counts;
+
+	void add(feature_id feature, fvalue value);
+	void merge(const FeatureStatistics &other);
+	void collect(sfmatrix *matrix);
+
+	bool isConstant(feature_id feature, quantity samples) const;
+	fvalue getScale(feature_id feature) const;
+
+};
+
+inline void FeatureStatistics::add(feature_id feature, fvalue value) {
+	if (feature >= counts.size()) {
+		mins.resize(feature + 1, 0.0);
+		maxs.resize(feature + 1, 0.0);
+		counts.resize(feature + 1, 0);
+	}
+	if (counts[feature] == 0) {
+		mins[feature] = value;
+		maxs[feature] = value;
+	} else {
+		mins[feature] = min(mins[feature], value);
+		maxs[feature] = max(maxs[feature], value);
+	}
+	counts[feature]++;
+}
+
+/*
+ * Missing values are zeros, so only features that are absent everywhere or
+ * present in all samples with a single value are constant.
+ */
+inline bool FeatureStatistics::isConstant(feature_id feature, quantity samples) const {
+	if (feature >= counts.size() || counts[feature] == 0) {
+		return true;
+	}
+	return counts[feature] == samples && mins[feature] == maxs[feature];
+}
+
+inline fvalue FeatureStatistics::getScale(feature_id feature) const {
+	return max((fvalue) fabs(mins[feature]), (fvalue) fabs(maxs[feature]));
+}
 
 /**
- * Structure containing training samples for SVM problem.
+ * Structure containing training samples for SVM problem. Samples are stored
+ * in CSR format, feature ids are the ones found in the data file.
  */
 struct DataSet {
 
 	map<label_id, string> labelNames;
-	list<label_id> labels;
-	list<map<feature_id, fvalue> > features;
+	vector<label_id> labels;
+	sfmatrix *features;
 
-	DataSet(map<label_id, string> labelNames, list<label_id> labels,
-			list<map<feature_id, fvalue> > features) :
+	// original feature id -> matrix column (INVALID_FEATURE_ID for dropped features)
+	vector<feature_id> mappings;
+
+	// collected while parsing, empty for preprocessed data
+	FeatureStatistics statistics;
+
+	DataSet(map<label_id, string> labelNames, vector<label_id> labels,
+			sfmatrix *features) :
 			labelNames(labelNames),
 			labels(labels),
 			features(features) {
@@ -50,6 +182,72 @@ struct DataSet {
 
 };
 
+/**
+ * Upper bounds on the storage needed to parse a chunk of sparse format data.
+ */
+struct SparseFormatBounds {
+
+	quantity rows;
+	offset_id entries;
+
+};
+
+/**
+ * CSR storage filled by the parser. Every row is padded to a multiple of
+ * SPARSE_ROW_ALIGNMENT, so 'entries' includes the padding of all rows.
+ */
+struct SparseFragment {
+
+	fvalue *values;
+	feature_id *features;
+	offset_id *offsets;
+	quantity *lengths;
+	label_id *labels;
+
+	quantity rows;
+	offset_id entries;
+	feature_id maxFeature;
+
+	FeatureStatistics statistics;
+
+};
+
+/**
+ * Tokenizer for data in sparse format (libSVM format) or CSV format. Parses
+ * text in place and writes the samples directly to the preallocated CSR arrays.
+ * Feature ids can be hashed into a fixed number of columns (the hashing trick).
+ * A header line of a CSV file (one with column names) is skipped.
+ */
+class SparseFormatParser {
+
+	map<string, label_id> labelIds;
+	label_id labelCounter;
+
+	quantity line;
+	DataFormat dataFormat;
+	quantity hashBits;
+
+	bool isHeader(const char *ptr, const char *end);
+	const char* readLabel(const char *ptr, const char *end, label_id &label);
+	const char* readFeatures(const char *ptr, const char *end, SparseFragment &fragment);
+	const char* readColumns(const char *ptr, const char *end, SparseFragment &fragment);
+	void finishRow(feature_id *features, fvalue *values, quantity length, bool sorted, SparseFragment &fragment);
+
+	feature_id hashFeature(unsigned long feature, fvalue &value);
+	void sortRow(feature_id *features, fvalue *values, quantity &length);
+	void fail(string reason);
+
+public:
+	SparseFormatParser(quantity firstLine = 0, DataFormat format = LIBSVM_FORMAT, quantity hashBits = 0);
+
+	static SparseFormatBounds measure(const char *begin, const char *end, DataFormat format = LIBSVM_FORMAT);
+
+	void parse(const char *begin, const char *end, SparseFragment &fragment);
+
+	map<label_id, string> getLabelMap();
+
+};
+
 /**
  * Interface for data set factories.
  */
@@ -62,19 +260,50 @@ public:
 
 };
 
+/**
+ * Part of the input file parsed by a single thread.
+ */
+struct SparseChunk {
+
+	const char *begin;
+	const char *end;
+
+	SparseFormatBounds bounds;
+	quantity firstLine;
+	offset_id firstEntry;
+	sample_id firstRow;
+
+	SparseFragment fragment;
+	map<label_id, string> labelNames;
+
+};
+
 /**
  * Data set factory capable of parsing data file in sparse format (libSVM format).
+ * The file is memory mapped and parsed without intermediate per-row containers.
+ * Large files are split at line boundaries and parsed by several threads; the
+ * result is identical to the one of the serial parse. Gzip and zstd compressed
+ * files are decompressed on the fly. CSV files are read into the same arrays.
  */
 class SparseFormatDataSetFactory: public DataSetFactory {
 
-	istream& input;
+	string fileName;
+	InputParams params;
+	DataFormat dataFormat;
+
+	quantity getThreadNumber(size_t fileSize);
+	vector<SparseChunk> splitChunks(const MappedFile &file, quantity number);
 
-	map<feature_id, fvalue> readFeatures(istream& lineStream);
-	map<label_id, string> getLabelMap(map<string, label_id>& labelIds);
+	void parseChunks(vector<SparseChunk> &chunks, SparseFragment &result);
+	map<label_id, string> mergeChunks(vector<SparseChunk> &chunks, SparseFragment &result);
+
+	map<label_id, string> parseStream(Compression compression, SparseFragment &result);
 
 public:
-	SparseFormatDataSetFactory(istream& input) :
-			input(input) {
+	SparseFormatDataSetFactory(string fileName, InputParams params = InputParams()) :
+			fileName(fileName),
+			params(params),
+			dataFormat(detectFormat(fileName)) {
 	}
 
 	DataSet createDataSet();
@@ -82,4 +311,3 @@ public:
 };
 
 #endif
-
@@ -0,0 +1,117 @@
+/**************************************************************************
+ * This file is part of osvm, a Support Vector Machine solver.
+ * Copyright (C) 2012 Gabriella Melki (melkiga@vcu.edu), Vojislav Kecman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const string& fileName, bool writable) :
+		data(NULL),
+		length(0),
+		mapped(false) {
+	ifstream input(fileName.c_str(), ios::in | ios::binary | ios::ate);
+	if (!input) {
+		throw runtime_error("cannot open input file '" + fileName + "'");
+	}
+	length = (size_t) input.tellg();
+	data = new char[length + 1];
+	input.seekg(0);
+	input.read(data, length);
+}
+
+MappedFile::~MappedFile() {
+	delete [] data;
+}
+
+void MappedFile::prefetch(const char *from, const char *to) {
+}
+
+void MappedFile::release(const char *from, const char *to) {
+}
+
+#else
+
+MappedFile::MappedFile(const string& fileName, bool writable) :
+		data(NULL),
+		length(0),
+		mapped(false) {
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw runtime_error("cannot open input file '" + fileName + "'");
+	}
+	struct stat info;
+	if (fstat(fd, &info) < 0) {
+		close(fd);
+		throw runtime_error("cannot stat input file '" + fileName + "'");
+	}
+	length = (size_t) info.st_size;
+	if (length > 0) {
+		int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+		void *region = mmap(NULL, length, protection, MAP_PRIVATE, fd, 0);
+		if (region == MAP_FAILED) {
+			close(fd);
+			throw runtime_error("cannot map input file '" + fileName + "'");
+		}
+		// text input is scanned once, writable views serve as random access sample stores
+		madvise(region, length, writable ? MADV_WILLNEED : MADV_SEQUENTIAL);
+		data = (char*) region;
+		mapped = true;
+	}
+	close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (mapped) {
+		munmap((void*) data, length);
+	}
+}
+
+inline size_t pageSize() {
+	static size_t size = (size_t) sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+void MappedFile::prefetch(const char *from, const char *to) {
+	size_t first = (size_t) (max(from, (const char*) data) - data) / pageSize() * pageSize();
+	size_t last = (size_t) (min(to, (const char*) data + length) - data);
+	if (mapped && first < last) {
+		madvise(data + first, last - first, MADV_WILLNEED);
+	}
+}
+
+/*
+ * Only pages lying entirely within the range are dropped.
+ */
+void MappedFile::release(const char *from, const char *to) {
+	size_t first = ((size_t) (max(from, (const char*) data) - data) + pageSize() - 1) / pageSize() * pageSize();
+	size_t last = (size_t) (min(to, (const char*) data + length) - data) / pageSize() * pageSize();
+	if (mapped && first < last) {
+		madvise(data + first, last - first, MADV_DONTNEED);
+	}
+}
+
+#endif
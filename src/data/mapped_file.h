@@ -0,0 +1,75 @@
+/**************************************************************************
+ * This file is part of osvm, a Support Vector Machine solver.
+ * Copyright (C) 2012 Gabriella Melki (melkiga@vcu.edu), Vojislav Kecman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#include "../math/matrix_sparse.h"
+
+using namespace std;
+
+/**
+ * View of a whole file. The file is memory mapped where the platform allows
+ * it, otherwise it is read into a private buffer. A writable view is private:
+ * changes are never written back to the file.
+ *
+ * Pages of a read only view can be prefetched and released; released pages
+ * are read from the file again when accessed.
+ */
+class MappedFile: public MatrixStorage {
+
+	char *data;
+	size_t length;
+
+	bool mapped;
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	MappedFile(const string& fileName, bool writable = false);
+	~MappedFile();
+
+	char* begin() const;
+	char* end() const;
+	size_t size() const;
+
+	// prefetching rows of samples stored in the file is left to the default
+	using MatrixStorage::prefetch;
+	void prefetch(const char *from, const char *to);
+	void release(const char *from, const char *to);
+
+};
+
+inline char* MappedFile::begin() const {
+	return data;
+}
+
+inline char* MappedFile::end() const {
+	return data + length;
+}
+
+inline size_t MappedFile::size() const {
+	return length;
+}
+
+#endif
@@ -18,45 +18,153 @@
 
 #include "solver_factory.h"
 
-sfmatrix* FeatureMatrixBuilder::getFeatureMatrix(list<map<feature_id, fvalue> >& features, map<feature_id, feature_id>& mappings) {
-	// count total number of features
-	quantity total = 0;
-	list<map<feature_id, fvalue> >::iterator lit;
-	for (lit = features.begin(); lit != features.end(); lit++) {
-		total += (quantity) lit->size();
-	}
-
-	// initialize storage
-	fvalue *vals = new fvalue[total + features.size()];
-	feature_id *feats = new feature_id[total + features.size()];
-
-	id *offsets = new id[features.size()];
-
-	sample_id row = 0;
-	id offset = 0;
-
-	for (lit = features.begin(); lit != features.end(); lit++) {
-		offsets[row] = offset;
-		map<feature_id, fvalue>::iterator mit;
-		for (mit = lit->begin(); mit != lit->end(); mit++) {
-			feats[offset] = mappings[mit->first];
-			vals[offset] = mit->second;
-			offset++;
+/*
+ * Records the length of the row compacted to [start, end) and pads it with
+ * zero entries, returns the start of the next row.
+ */
+inline offset_id closeRow(sfmatrix *features, sample_id row, offset_id start, offset_id end) {
+	features->lengths[row] = (quantity) (end - start);
+	offset_id next = start + padRow(end - start);
+	for (offset_id offset = end; offset < next; offset++) {
+		features->features[offset] = 0;
+		features->values[offset] = 0.0;
+	}
+	return next;
+}
+
+/*
+ * Compacts the matrix in place: features are renumbered according to
+ * 'mappings' (entries of dropped features are removed) and every value is
+ * divided by the scale of its new column. Rows have to be stored in order.
+ */
+sfmatrix* FeatureMatrixBuilder::getFeatureMatrix(sfmatrix *features, vector<feature_id>& mappings, vector<fvalue>& scales) {
+	fvalue *vals = features->values;
+	feature_id *feats = features->features;
+	offset_id target = 0;
+	for (sample_id row = 0; row < features->height; row++) {
+		offset_id offset = features->offsets[row];
+		offset_id end = offset + features->lengths[row];
+		offset_id start = target;
+		features->offsets[row] = target;
+		for (; offset < end; offset++) {
+			feature_id feature = mappings[feats[offset]];
+			if (feature != INVALID_FEATURE_ID) {
+				feats[target] = feature;
+				vals[target] = vals[offset] / scales[feature];
+				target++;
+			}
 		}
-		feats[offset] = INVALID_FEATURE_ID;
-		vals[offset] = 0.0;
-		offset++;
+		target = closeRow(features, row, start, target);
+	}
+
+	feature_id width = 0;
+	vector<feature_id>::iterator it;
+	for (it = mappings.begin(); it != mappings.end(); it++) {
+		if (*it != INVALID_FEATURE_ID) {
+			width++;
+		}
+	}
+	features->width = width;
+	return features;
+}
 
-		row++;
+/*
+ * Moves the given columns to an aligned row-major matrix (in the order
+ * listed), the remaining entries are compacted in place. If all columns are
+ * moved the sparse arrays are released (unless they belong to a storage).
+ * Rows have to be stored in order.
+ */
+sfmatrix* FeatureMatrixBuilder::split(sfmatrix *features, vector<feature_id>& columns) {
+	vector<feature_id> slots(features->width, INVALID_FEATURE_ID);
+	for (size_t slot = 0; slot < columns.size(); slot++) {
+		slots[columns[slot]] = (feature_id) slot;
 	}
 
-	return new sfmatrix(vals, feats, offsets, features.size(), mappings.size());
+	DenseMatrix *dense = new DenseMatrix(features->height, columns.size());
+	fvalue *vals = features->values;
+	feature_id *feats = features->features;
+	offset_id target = 0;
+	for (sample_id row = 0; row < features->height; row++) {
+		fvalue *values = dense->row(row);
+		offset_id offset = features->offsets[row];
+		offset_id end = offset + features->lengths[row];
+		offset_id start = target;
+		features->offsets[row] = target;
+		for (; offset < end; offset++) {
+			feature_id slot = slots[feats[offset]];
+			if (slot != INVALID_FEATURE_ID) {
+				values[slot] = vals[offset];
+			} else {
+				feats[target] = feats[offset];
+				vals[target] = vals[offset];
+				target++;
+			}
+		}
+		target = closeRow(features, row, start, target);
+	}
+	features->dense = dense;
+
+	if (columns.size() == features->width) {
+		if (features->storage == NULL) {
+			freeEntries(features->values);
+			freeEntries(features->features);
+			delete [] features->offsets;
+			delete [] features->lengths;
+		}
+		features->values = NULL;
+		features->features = NULL;
+		features->offsets = NULL;
+		features->lengths = NULL;
+	}
+	return features;
 }
 
-BaseSolverFactory::BaseSolverFactory(istream& input, TrainParams params, StopCriterion strategy) :
+sfmatrix* FeatureMatrixBuilder::densify(sfmatrix *features) {
+	vector<feature_id> columns;
+	for (feature_id feat = 0; feat < features->width; feat++) {
+		columns.push_back(feat);
+	}
+	return split(features, columns);
+}
+
+/*
+ * Replaces the sparse arrays of binary samples (all values are ones) with
+ * rows of bits. The arrays are released unless they belong to a storage.
+ */
+sfmatrix* FeatureMatrixBuilder::binarize(sfmatrix *features) {
+	BitMatrix *bits = new BitMatrix(features->height, features->width);
+	for (sample_id row = 0; row < features->height; row++) {
+		feature_id *iptr = features->features + features->offsets[row];
+		quantity length = features->lengths[row];
+		for (quantity i = 0; i < length; i++) {
+			bits->set(row, iptr[i]);
+		}
+	}
+	features->bits = bits;
+
+	if (features->storage == NULL) {
+		freeEntries(features->values);
+		freeEntries(features->features);
+		delete [] features->offsets;
+		delete [] features->lengths;
+	}
+	features->values = NULL;
+	features->features = NULL;
+	features->offsets = NULL;
+	features->lengths = NULL;
+	return features;
+}
+
+BaseSolverFactory::BaseSolverFactory(string fileName, TrainParams params, StopCriterion strategy, InputParams input, MatrixType matrixType) :
+		fileName(fileName),
 		input(input),
 		params(params),
 		strategy(strategy),
+		matrixType(matrixType),
+		precision(input.precision),
+		precisionError(0.0),
+		indexEncoding(input.indexEncoding),
+		density(0.0),
 		matrixBuilder(new FeatureMatrixBuilder()) {
 }
 
@@ -73,70 +181,176 @@ AbstractSolver* BaseSolverFactory::createSolver(MulticlassApproach type, map<lab
 }
 
 AbstractSolver* BaseSolverFactory::getSolver() {
-	SparseFormatDataSetFactory dataSetFactory(input);
-	DataSet dataSet = dataSetFactory.createDataSet();
+	DataSet dataSet = readDataSet();
+	if (!input.binaryOutput.empty()) {
+		BinaryDataSetWriter writer(input.binaryOutput);
+		writer.write(dataSet);
+	}
 
-	map<feature_id, feature_id> mappings = findOptimalFeatureMappings(dataSet.features);
-	sfmatrix *x = matrixBuilder->getFeatureMatrix(dataSet.features, mappings);
+	sfmatrix *x = dataSet.features;
+	vector<feature_id> denseColumns;
+	matrixType = selectMatrixType(x, denseColumns);
+	if (matrixType == DENSE) {
+		x = matrixBuilder->densify(x);
+	} else if (matrixType == HYBRID) {
+		x = matrixBuilder->split(x, denseColumns);
+	} else if (matrixType == BINARY) {
+		x = matrixBuilder->binarize(x);
+	}
 	label_id *y = getLabelVector(dataSet.labels);
 
 	x = preprocess(x, y);
 
+	// out of core samples stay in the precision of the data file
+	x->narrow(input.precision);
+	precision = x->precision;
+	precisionError = x->precisionError;
+	if (input.indexEncoding == DELTA_INDICES) {
+		x->compressIndices();
+	}
+	indexEncoding = x->indices ? DELTA_INDICES : PLAIN_INDICES;
+
 	StopCriterionStrategy *strategy = getStopCriterion();
 
 	return createSolver(multiclass, dataSet.labelNames, x, y, params, strategy);
 }
 
+/*
+ * Returns pruned and normalized data, either parsed from the data file or
+ * loaded from a preprocessed binary file.
+ */
+DataSet BaseSolverFactory::readDataSet() {
+	if (!input.binaryInput.empty()) {
+		BinaryDataSetFactory dataSetFactory(input.binaryInput, (size_t) input.residentMemory << 20);
+		return dataSetFactory.createDataSet();
+	}
+
+	SparseFormatDataSetFactory dataSetFactory(fileName, input);
+	DataSet dataSet = dataSetFactory.createDataSet();
+
+	// pruning, renumbering and scaling take a single pass over the data
+	dataSet.mappings = findOptimalFeatureMappings(dataSet);
+	vector<fvalue> scales = getFeatureScales(dataSet);
+	matrixBuilder->getFeatureMatrix(dataSet.features, dataSet.mappings, scales);
+	return dataSet;
+}
+
 CrossValidationSolver* BaseSolverFactory::getCrossValidationSolver(quantity innerFolds, quantity outerFolds) {
 	AbstractSolver *solver = getSolver();
 	return new CrossValidationSolver(solver, innerFolds, outerFolds);
 }
 
-map<feature_id, feature_id> BaseSolverFactory::findOptimalFeatureMappings(list<map<feature_id, fvalue> >& features) {
-	quantity dimension = 0;
-	map<feature_id, fvalue> fmax;
-	map<feature_id, fvalue> fmin;
+/*
+ * Constant features are dropped, the remaining ones are numbered
+ * consecutively in the order of their original ids.
+ */
+vector<feature_id> BaseSolverFactory::findOptimalFeatureMappings(DataSet &dataSet) {
+	sfmatrix *features = dataSet.features;
+	FeatureStatistics &stats = dataSet.statistics;
 
-	list<map<feature_id, fvalue> >::iterator lit;
-	for (lit = features.begin(); lit != features.end(); lit++) {
-		map<feature_id, fvalue>::iterator mit;
-		for (mit = lit->begin(); mit != lit->end(); mit++) {
-			dimension = max((quantity) mit->first, dimension);
-			fmax[mit->first] = max(fmax[mit->first], mit->second);
-			fmin[mit->first] = min(fmin[mit->first], mit->second);
+	feature_id available = 0;
+	vector<feature_id> mappings(features->width, INVALID_FEATURE_ID);
+	for (feature_id feat = 0; feat < features->width; feat++) {
+		if (!stats.isConstant(feat, features->height)) {
+			mappings[feat] = available++;
 		}
 	}
+	return mappings;
+}
 
-	feature_id available = 0;
-	map<feature_id, feature_id> mappings;
-	for (feature_id feat = 0; feat <= dimension; feat++) {
-		if (fmax[feat] == fmin[feat]) {
-			for (lit = features.begin(); lit != features.end(); lit++) {
-				lit->erase(feat);
-			}
-		} else {
-			mappings[feat] = available++;
+/*
+ * Measures the density of the data and the fill rate of every column. Sparse
+ * data stays in CSR format, nearly dense data is densified and otherwise the
+ * frequently populated columns are made dense if they hold enough entries.
+ * Binary data (e.g. one-hot encoded) goes to rows of bits first, unless they
+ * would take more memory than the CSR rows. The requested storage (unless
+ * automatic) is only completed with the columns to be made dense.
+ */
+MatrixType BaseSolverFactory::selectMatrixType(sfmatrix *x, vector<feature_id>& denseColumns) {
+	vector<quantity> counts(x->width, 0);
+	offset_id entries = 0;
+	offset_id paddedEntries = 0;
+	bool binary = true;
+	for (sample_id row = 0; row < x->height; row++) {
+		feature_id *iptr = x->features + x->offsets[row];
+		fvalue *fptr = x->values + x->offsets[row];
+		quantity length = x->lengths[row];
+		for (quantity i = 0; i < length; i++) {
+			counts[iptr[i]]++;
+			binary = binary && fptr[i] == 1.0;
 		}
+		entries += length;
+		paddedEntries += padRow(length);
 	}
+	density = x->height * x->width > 0 ? entries / ((double) x->height * x->width) : 1.0;
 
-	quantity featureNum = 0;
-	for (lit = features.begin(); lit != features.end(); lit++) {
-		featureNum += (quantity) lit->size();
+	offset_id denseEntries = 0;
+	for (feature_id feat = 0; feat < x->width; feat++) {
+		if (counts[feat] >= DENSE_COLUMN_FILL * x->height) {
+			denseColumns.push_back(feat);
+			denseEntries += counts[feat];
+		}
 	}
 
-	double density = 100.0 * featureNum / (features.size() * mappings.size());
-	//logger << format("data density: %.2f[%%]") % density << endl;
-	return mappings;
+	if (matrixType == BINARY && !binary) {
+		throw invalid_data_format("binary storage requires all feature values to be ones");
+	}
+	if (matrixType != AUTO) {
+		return matrixType;
+	}
+	if (x->storage && input.residentMemory > 0) {
+		// out of core samples have to stay in the mapped file
+		return SPARSE;
+	}
+	size_t bitBytes = x->height * ((x->width + BIT_WORD_SIZE - 1) / BIT_WORD_SIZE) * sizeof(uint64_t);
+	if (binary && bitBytes <= paddedEntries * (sizeof(fvalue) + sizeof(feature_id))) {
+		return BINARY;
+	}
+	if (density >= DENSE_MATRIX_DENSITY) {
+		return DENSE;
+	}
+	if (!denseColumns.empty() && denseEntries >= HYBRID_DENSE_SHARE * entries) {
+		return HYBRID;
+	}
+	return SPARSE;
 }
 
-label_id* BaseSolverFactory::getLabelVector(list<label_id>& labels) {
-	label_id *dataLabels = new label_id[labels.size()];
-	quantity id = 0;
-
-	list<label_id>::iterator lit;
-	for (lit = labels.begin(); lit != labels.end(); lit++) {
-		dataLabels[id++] = *lit;
+/*
+ * Maximum absolute value of every retained feature (indexed by new column).
+ */
+vector<fvalue> BaseSolverFactory::getFeatureScales(DataSet &dataSet) {
+	vector<fvalue> scales;
+	for (feature_id feat = 0; feat < dataSet.mappings.size(); feat++) {
+		if (dataSet.mappings[feat] != INVALID_FEATURE_ID) {
+			scales.push_back(dataSet.statistics.getScale(feat));
+		}
 	}
+	return scales;
+}
+
+MatrixType BaseSolverFactory::getMatrixType() {
+	return matrixType;
+}
+
+Precision BaseSolverFactory::getPrecision() {
+	return precision;
+}
+
+fvalue BaseSolverFactory::getPrecisionError() {
+	return precisionError;
+}
+
+IndexEncoding BaseSolverFactory::getIndexEncoding() {
+	return indexEncoding;
+}
+
+double BaseSolverFactory::getDensity() {
+	return density;
+}
+
+label_id* BaseSolverFactory::getLabelVector(vector<label_id>& labels) {
+	label_id *dataLabels = new label_id[labels.size()];
+	copy(labels.begin(), labels.end(), dataLabels);
 	return dataLabels;
 }
 
@@ -146,7 +360,8 @@ StopCriterionStrategy* BaseSolverFactory::getStopCriterion() {
 
 sfmatrix* BaseSolverFactory::preprocess(sfmatrix *x, label_id *y) {
 	FeatureProcessor proc;
-	proc.normalize(x);
 	proc.randomize(x, y);
+	// the shuffled rows are read in order from now on
+	x->relayout();
 	return x;
 }
@@ -32,6 +32,7 @@
 
 #include "../svm/strategy.h"
 #include "dataset.h"
+#include "binary.h"
 #include "../logging/log.h"
 #include "../svm/pairwise_solver.h"
 #include "../svm/validation.h"
@@ -48,40 +49,77 @@ enum MulticlassApproach {
 	PAIRWISE
 };
 
+enum MatrixType {
+	SPARSE,
+	DENSE,
+	HYBRID,
+	BINARY,
+	AUTO
+};
+
+// data at least this dense is stored in a dense matrix
+#define DENSE_MATRIX_DENSITY 0.75
+// columns at least this populated are stored densely in a hybrid matrix
+#define DENSE_COLUMN_FILL 0.5
+// hybrid storage is used if the dense columns hold at least this share of entries
+#define HYBRID_DENSE_SHARE 0.5
+
 class FeatureMatrixBuilder {
 
 public:
-	sfmatrix* getFeatureMatrix(list<map<feature_id, fvalue> >& features, map<feature_id, feature_id>& mappings);
+	sfmatrix* getFeatureMatrix(sfmatrix *features, vector<feature_id>& mappings, vector<fvalue>& scales);
+	sfmatrix* split(sfmatrix *features, vector<feature_id>& columns);
+	sfmatrix* densify(sfmatrix *features);
+	sfmatrix* binarize(sfmatrix *features);
 };
 
 class BaseSolverFactory {
 
 private:
-	istream& input;
+	string fileName;
+	InputParams input;
 
 	TrainParams params;
 	StopCriterion strategy;
 	MulticlassApproach multiclass;
+	MatrixType matrixType;
+	Precision precision;
+	fvalue precisionError;
+	IndexEncoding indexEncoding;
+	double density;
 
 	bool reduceDim;
 
 	FeatureMatrixBuilder *matrixBuilder;
 
-	map<feature_id, feature_id> findOptimalFeatureMappings(list<map<feature_id, fvalue> >& features);
-	label_id* getLabelVector(list<label_id>& labels);
+	label_id* getLabelVector(vector<label_id>& labels);
 	StopCriterionStrategy* getStopCriterion();
 
   	sfmatrix* preprocess(sfmatrix *x, label_id *y);
 
 	AbstractSolver* createSolver(MulticlassApproach type, map<label_id,string> labels, sfmatrix* x, label_id* y, TrainParams& params, StopCriterionStrategy* strategy);
 
+protected:
+	DataSet readDataSet();
+
+	vector<feature_id> findOptimalFeatureMappings(DataSet &dataSet);
+	vector<fvalue> getFeatureScales(DataSet &dataSet);
+	MatrixType selectMatrixType(sfmatrix *x, vector<feature_id>& denseColumns);
+
 public:
-	BaseSolverFactory(istream& input, TrainParams params = TrainParams(), StopCriterion strategy = YOC);
+	BaseSolverFactory(string fileName, TrainParams params = TrainParams(), StopCriterion strategy = YOC, InputParams input = InputParams(), MatrixType matrixType = AUTO);
 	virtual ~BaseSolverFactory();
 
 	AbstractSolver* getSolver();
 	CrossValidationSolver* getCrossValidationSolver(quantity innerFolds, quantity outerFolds);
 
+	// storage of the samples, their precision and density (known once the solver is created)
+	MatrixType getMatrixType();
+	Precision getPrecision();
+	fvalue getPrecisionError();
+	IndexEncoding getIndexEncoding();
+	double getDensity();
+
 };
 
 
@@ -18,33 +18,23 @@
 
 #include "feature.h"
 
-void FeatureProcessor::normalize(sfmatrix *samples) {
-	// project features to the range [0, 1]
-	vector<fvalue> maxs(samples->width, 0.0);
-	for (sample_id smpl = 0; smpl < samples->height; smpl++) {
-		id offset = samples->offsets[smpl];
-		while (samples->features[offset] != INVALID_FEATURE_ID) {
-			feature_id feature = samples->features[offset];
-			fvalue value = samples->values[offset];
-			maxs[feature] = max(maxs[feature], (fvalue) fabs(value));
-			offset++;
-		}
-	}
-	for (sample_id smpl = 0; smpl < samples->height; smpl++) {
-		id offset = samples->offsets[smpl];
-		while (samples->features[offset] != INVALID_FEATURE_ID) {
-			feature_id feature = samples->features[offset];
-			samples->values[offset] /= maxs[feature];
-			offset++;
-		}
-	}
-}
-
 void FeatureProcessor::randomize(sfmatrix *samples, label_id *labels) {
 	IdGenerator gen = Generators::create();
 	for (id row = 0; row < samples->height; row++) {
 		id rand = gen.nextId(samples->height);
-		swap(samples->offsets[row], samples->offsets[rand]);
+		if (samples->offsets) {
+			swap(samples->offsets[row], samples->offsets[rand]);
+			swap(samples->lengths[row], samples->lengths[rand]);
+		}
+		if (samples->dense) {
+			samples->dense->swapRows(row, rand);
+		}
+		if (samples->bits) {
+			samples->bits->swapRows(row, rand);
+		}
 		swap(labels[row], labels[rand]);
+		if (samples->norms) {
+			swap(samples->norms[row], samples->norms[rand]);
+		}
 	}
 }
@@ -29,7 +29,6 @@
 class FeatureProcessor {
 
 public:
-	void normalize(sfmatrix *samples);
 	void randomize(sfmatrix *samples, label_id *labels);
 };
 
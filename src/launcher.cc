@@ -2,33 +2,66 @@
 #include "launcher.h"
 
 CrossValidationSolver* ApplicationLauncher::createCrossValidator() {
-	ifstream input(conf.dataFile.c_str());
-	BaseSolverFactory reader(input, conf.trainingParams, conf.stopCriterion);
+	BaseSolverFactory reader(conf.dataFile, conf.trainingParams, conf.stopCriterion, conf.inputParams, conf.matrixType);
 
 	Timer timer(true);
 	CrossValidationSolver *solver
 			= (CrossValidationSolver*) reader.getCrossValidationSolver(
 					conf.validation.innerFolds, conf.validation.outerFolds);
 	timer.stop();
+	reportStorage(reader);
 
 	//logger << format("input reading time: %.2f[s]\n") % timer.getTimeElapsed();
-	input.close();
 	return solver;
 }
 
 AbstractSolver* ApplicationLauncher::createSolver() {
-	ifstream input(conf.dataFile.c_str());
-	BaseSolverFactory reader(input, conf.trainingParams, conf.stopCriterion);
+	BaseSolverFactory reader(conf.dataFile, conf.trainingParams, conf.stopCriterion, conf.inputParams, conf.matrixType);
 
 	Timer timer(true);
 	AbstractSolver *solver = reader.getSolver();
 	timer.stop();
+	reportStorage(reader);
 
 	//logger << format("input reading time: %.2f[s]\n") % timer.getTimeElapsed();
-	input.close();
 	return solver;
 }
 
+/*
+ * The storage chosen for the samples is logged and saved with the configuration.
+ */
+void ApplicationLauncher::reportStorage(BaseSolverFactory &reader) {
+	matrixType = reader.getMatrixType();
+	precision = reader.getPrecision();
+	indexEncoding = reader.getIndexEncoding();
+	logger << format("data density: %.2f[%%], storage: %s, precision: %s, indices: %s\n")
+			% (100.0 * reader.getDensity()) % getMatrixTypeName(matrixType)
+			% getPrecisionName(precision) % getIndexEncodingName(indexEncoding);
+	if (precision != DOUBLE_PRECISION) {
+		logger << format("largest value error: %.2e\n") % reader.getPrecisionError();
+	}
+}
+
+/*
+ * Reports how many times the sparse rows were laid out again in the order of
+ * the samples and the time it took.
+ */
+void ApplicationLauncher::reportLayout(sfmatrix *samples) {
+	logger << format("row re-layouts: %d, time: %.2f[s]\n")
+			% samples->relayouts % samples->relayoutTimer.getTimeElapsed();
+}
+
+/*
+ * Reports how many kernel rows the cache holds and how many of the rows
+ * requested by the solver were found there.
+ */
+void ApplicationLauncher::reportCache(CachedKernelEvaluator *cache) {
+	iteration lookups = cache->getLookups();
+	logger << format("kernel cache: %d rows, hit rate: %.2f[%%] (%d of %d rows)\n")
+			% cache->getCacheLines() % (lookups > 0 ? 100.0 * cache->getHits() / lookups : 0.0)
+			% cache->getHits() % lookups;
+}
+
 GridGaussianModelSelector* ApplicationLauncher::createModelSelector() {
 	GridGaussianModelSelector *selector;
 	PatternFactory factory;
@@ -43,10 +76,12 @@ Classifier* ApplicationLauncher::performModelSelection() {
 	GridGaussianModelSelector *selector = createModelSelector();
 	ModelSelectionResults params = selector->selectParameters(*solver, conf.searchRange);
 	timer.stop();
+	reportLayout(solver->getSamples());
+	reportCache(solver->getCache());
 
-	//logger << format("final result: time=%.2f[s], accuracy=%.2f[%%], C=%.4g, G=%.4g\n")
-	//		% timer.getTimeElapsed() % (100.0 * params.bestResult.accuracy)
-	//		% params.c % params.gamma;
+	logger << format("final result: time=%.2f[s], accuracy=%.2f[%%], C=%.4g, G=%.4g\n")
+			% timer.getTimeElapsed() % (100.0 * params.bestResult.accuracy)
+			% params.c % params.gamma;
 	
 	delete selector;
 	return solver->getClassifier();
@@ -59,9 +94,11 @@ Classifier* ApplicationLauncher::performNestedCrossValidation() {
 	GridGaussianModelSelector *selector = createModelSelector();
 	TestingResult res = selector->doNestedCrossValidation(*solver, conf.searchRange);
 	timer.stop();
+	reportLayout(solver->getSamples());
+	reportCache(solver->getCache());
 
-	//logger << format("final result: time=%.2f[s], accuracy=%.2f[%%]\n")
-	//		% timer.getTimeElapsed() % (100.0 * res.accuracy);
+	logger << format("final result: time=%.2f[s], accuracy=%.2f[%%]\n")
+			% timer.getTimeElapsed() % (100.0 * res.accuracy);
 	//model = solver->getClassifier();
 	std::shared_ptr<Classifier> o = std::make_shared<Classifier>(solver->getClassifier());
 	delete selector;
@@ -77,9 +114,11 @@ Classifier* ApplicationLauncher::performCrossValidation() {
 	solver->setKernelParams(conf.searchRange.cLow, param);
 	TestingResult result = solver->doCrossValidation();
 	timer.stop();
+	reportLayout(solver->getSamples());
+	reportCache(solver->getCache());
 
-	//logger << format("final result: time=%.2f[s], accuracy=%.2f[%%]\n")
-	//		% timer.getTimeElapsed() % (100.0 * result.accuracy);
+	logger << format("final result: time=%.2f[s], accuracy=%.2f[%%]\n")
+			% timer.getTimeElapsed() % (100.0 * result.accuracy);
 
 	return solver->getClassifier();
 }
@@ -93,6 +132,8 @@ Classifier* ApplicationLauncher::performTraining() {
 	solver->train();
 	Classifier* classifier = solver->getClassifier();
 	timer.stop();
+	reportLayout(solver->getSamples());
+	reportCache(solver->getCache());
 
 	sfmatrix *samples = solver->getSamples();
 	label_id *labels = solver->getLabels();
@@ -138,8 +179,17 @@ void ApplicationLauncher::run(pt::ptree& root) {
 	config.put(PR_OUTER_FLD,conf.validation.outerFolds);
 	config.put(PR_MARGIN, conf.trainingParams.margin);
 	config.put(PR_EPOCH, conf.trainingParams.epochs);
-	config.put(PR_INPUT, conf.dataFile);
+	if (conf.inputParams.binaryInput.empty()) {
+		config.put(PR_INPUT, conf.dataFile);
+	} else {
+		config.put(PR_READ_BINARY, conf.inputParams.binaryInput);
+	}
+	config.put(PR_HASH_BITS, conf.inputParams.hashBits);
 	config.put(PR_TEST_NAME, conf.testName);
+	config.put(PR_MATRIX_TYPE, getMatrixTypeName(matrixType));
+	config.put(PR_PRECISION, getPrecisionName(precision));
+	config.put(PR_INDEX_ENCODING, getIndexEncodingName(indexEncoding));
+	config.put(PR_EXP_ACCURACY, getExpAccuracyName(conf.trainingParams.expAccuracy));
 	pt::ptree& classif = root.get_child("classifier");
 	classifier->saveClassifier(classif);
 	
@@ -6,8 +6,15 @@
 class ApplicationLauncher {
 
 	Configuration &conf;
+	MatrixType matrixType;
+	Precision precision;
+	IndexEncoding indexEncoding;
 
 protected:
+	void reportStorage(BaseSolverFactory &reader);
+	void reportLayout(sfmatrix *samples);
+	void reportCache(CachedKernelEvaluator *cache);
+
 	CrossValidationSolver* createCrossValidator();
 
 	AbstractSolver* createSolver();
@@ -23,7 +30,11 @@ protected:
 	Classifier* performNestedCrossValidation();
 
 public:
-	ApplicationLauncher(Configuration &conf) : conf(conf) {
+	ApplicationLauncher(Configuration &conf) :
+			conf(conf),
+			matrixType(conf.matrixType),
+			precision(conf.inputParams.precision),
+			indexEncoding(conf.inputParams.indexEncoding) {
 	}
 
   	void run(pt::ptree& model);
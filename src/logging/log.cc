@@ -18,4 +18,5 @@
 
 #include "log.h"
 
-ostream &logger = (cout << unitbuf);
+// the model is written to the standard output, so the log goes to the error stream
+ostream &logger = (cerr << unitbuf);
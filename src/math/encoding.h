@@ -0,0 +1,211 @@
+/**************************************************************************
+ * This file is part of osvm, a Support Vector Machine solver.
+ * Copyright (C) 2012 Gabriella Melki (melkiga@vcu.edu), Vojislav Kecman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+#ifndef ENCODING_H_
+#define ENCODING_H_
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include "numeric.h"
+
+// largest magnitude of a quantized value
+#define QUANTIZED_MAX 127
+
+/// <summary>Half precision value (IEEE 754 binary16).</summary>
+struct Half {
+	uint16_t bits;
+};
+
+/// <summary>Bfloat16 value (the upper half of a single precision value).</summary>
+struct BFloat16 {
+	uint16_t bits;
+};
+
+inline uint32_t floatBits(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(float));
+	return bits;
+}
+
+inline float bitsFloat(uint32_t bits) {
+	float value;
+	memcpy(&value, &bits, sizeof(float));
+	return value;
+}
+
+/*
+ * Rounds to the nearest half precision value (ties to even). Values below the
+ * normal range become subnormals, values beyond it infinities.
+ */
+inline Half encodeHalf(float value) {
+	uint32_t bits = floatBits(value);
+	uint16_t sign = (uint16_t) ((bits >> 16) & 0x8000);
+	uint32_t magnitude = bits & 0x7fffffff;
+	Half half;
+	if (magnitude > 0x7f800000) {
+		half.bits = sign | 0x7e00;
+	} else if (magnitude >= 0x47800000) {
+		half.bits = sign | 0x7c00;
+	} else if (magnitude < 0x38800000) {
+		half.bits = sign | (uint16_t) lrintf(fabsf(value) * 16777216.0f);
+	} else {
+		magnitude += 0xfff + ((magnitude >> 13) & 1);
+		half.bits = sign | (uint16_t) ((magnitude - 0x38000000) >> 13);
+	}
+	return half;
+}
+
+/*
+ * Rounds to the nearest bfloat16 value (ties to even).
+ */
+inline BFloat16 encodeBFloat16(float value) {
+	uint32_t bits = floatBits(value);
+	BFloat16 bfloat;
+	if ((bits & 0x7fffffff) > 0x7f800000) {
+		bfloat.bits = (uint16_t) ((bits >> 16) | 0x40);
+	} else {
+		bfloat.bits = (uint16_t) ((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+	}
+	return bfloat;
+}
+
+/*
+ * Rounds value / scale to the nearest quantized value.
+ */
+inline int8_t quantize(float value, float scale) {
+	if (scale == 0.0f) {
+		return 0;
+	}
+	long quantized = lrintf(value / scale);
+	quantized = quantized > QUANTIZED_MAX ? QUANTIZED_MAX : quantized;
+	quantized = quantized < -QUANTIZED_MAX ? -QUANTIZED_MAX : quantized;
+	return (int8_t) quantized;
+}
+
+inline float decode(float value) {
+	return value;
+}
+
+inline double decode(double value) {
+	return value;
+}
+
+inline float decode(Half value) {
+	uint32_t sign = (uint32_t) (value.bits & 0x8000) << 16;
+	uint32_t exponent = (value.bits >> 10) & 0x1f;
+	uint32_t mantissa = value.bits & 0x3ff;
+	if (exponent == 0) {
+		float magnitude = mantissa / 16777216.0f;
+		return sign ? -magnitude : magnitude;
+	}
+	if (exponent == 0x1f) {
+		return bitsFloat(sign | 0x7f800000 | (mantissa << 13));
+	}
+	return bitsFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+inline float decode(BFloat16 value) {
+	return bitsFloat((uint32_t) value.bits << 16);
+}
+
+// quantized values still have to be multiplied by the scale of their feature
+inline float decode(int8_t value) {
+	return value;
+}
+
+/*
+ * Feature ids of a row (increasing) are stored as the byte width of the gaps
+ * (1, 2 or 4 bytes, enough for the largest one), followed by the first id and
+ * the gaps between consecutive ids. Gaps of the same width can be decoded
+ * without branching.
+ */
+inline uint8_t deltaWidth(const feature_id *ids, quantity count) {
+	feature_id largest = 0;
+	for (quantity i = 1; i < count; i++) {
+		largest = largest > ids[i] - ids[i - 1] ? largest : ids[i] - ids[i - 1];
+	}
+	return largest <= UINT8_MAX ? 1 : largest <= UINT16_MAX ? 2 : 4;
+}
+
+/*
+ * Number of bytes taken by the ids encoded with encodeDeltas.
+ */
+inline size_t deltaBytes(uint8_t width, quantity count) {
+	return count > 0 ? 1 + sizeof(feature_id) + (count - 1) * width : 1;
+}
+
+/*
+ * Writes the ids in the format described above. Returns the end of the
+ * written bytes.
+ */
+inline uint8_t* encodeDeltas(const feature_id *ids, quantity count, uint8_t *bytes) {
+	uint8_t width = deltaWidth(ids, count);
+	*bytes++ = width;
+	if (count == 0) {
+		return bytes;
+	}
+	memcpy(bytes, ids, sizeof(feature_id));
+	bytes += sizeof(feature_id);
+	for (quantity i = 1; i < count; i++) {
+		feature_id gap = ids[i] - ids[i - 1];
+		if (width == 1) {
+			*bytes = (uint8_t) gap;
+		} else if (width == 2) {
+			uint16_t shortGap = (uint16_t) gap;
+			memcpy(bytes, &shortGap, sizeof(uint16_t));
+		} else {
+			memcpy(bytes, &gap, sizeof(feature_id));
+		}
+		bytes += width;
+	}
+	return bytes;
+}
+
+template<typename G>
+inline void decodeGaps(const uint8_t *bytes, quantity count, feature_id *ids) {
+	feature_id id = ids[0];
+	for (quantity i = 1; i < count; i++) {
+		G gap;
+		memcpy(&gap, bytes + (i - 1) * sizeof(G), sizeof(G));
+		id += gap;
+		ids[i] = id;
+	}
+}
+
+/*
+ * Reads 'count' ids written by encodeDeltas.
+ */
+inline void decodeDeltas(const uint8_t *bytes, quantity count, feature_id *ids) {
+	if (count == 0) {
+		return;
+	}
+	uint8_t width = bytes[0];
+	memcpy(ids, bytes + 1, sizeof(feature_id));
+	const uint8_t *gaps = bytes + 1 + sizeof(feature_id);
+	if (width == 1) {
+		decodeGaps<uint8_t>(gaps, count, ids);
+	} else if (width == 2) {
+		decodeGaps<uint16_t>(gaps, count, ids);
+	} else {
+		decodeGaps<uint32_t>(gaps, count, ids);
+	}
+}
+
+#endif
@@ -0,0 +1,101 @@
+/**************************************************************************
+ * This file is part of osvm, a Support Vector Machine solver.
+ * Copyright (C) 2012 Gabriella Melki (melkiga@vcu.edu), Vojislav Kecman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+#include "exp.h"
+
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_EXP
+#include <immintrin.h>
+#endif
+
+template<int D>
+static void scaledExpScalar(fvalue scale, fvalue *values, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		values[i] = (fvalue) approximateExp<D>(scale * values[i]);
+	}
+}
+
+#ifdef VECTOR_EXP
+
+/*
+ * approximateExp of 4 arguments at once (the same operations, so the results
+ * do not depend on the path taken). Blocks underflowing entirely are zeroed
+ * without evaluating the polynomial.
+ */
+template<int D>
+__attribute__((target("avx2")))
+static void scaledExpAvx2(double scale, double *values, size_t count) {
+	const __m256d shifter = _mm256_set1_pd(6755399441055744.0);
+	const __m256d underflow = _mm256_set1_pd(EXP_UNDERFLOW);
+	const __m256d factor = _mm256_set1_pd(scale);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m256d x = _mm256_mul_pd(factor, _mm256_loadu_pd(values + i));
+		__m256d nonzero = _mm256_cmp_pd(x, underflow, _CMP_GE_OQ);
+		if (_mm256_movemask_pd(nonzero) == 0) {
+			_mm256_storeu_pd(values + i, _mm256_setzero_pd());
+			continue;
+		}
+		x = _mm256_min_pd(x, _mm256_set1_pd(EXP_OVERFLOW));
+		__m256d t = _mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(M_LOG2E)), shifter);
+		__m256d n = _mm256_sub_pd(t, shifter);
+		__m256d r = _mm256_sub_pd(x, _mm256_mul_pd(n, _mm256_set1_pd(0.693147180369123816490)));
+		r = _mm256_sub_pd(r, _mm256_mul_pd(n, _mm256_set1_pd(1.90821492927058770002e-10)));
+		__m256d p = _mm256_set1_pd(inverseFactorial(D));
+		for (int k = D - 1; k >= 0; k--) {
+			p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(inverseFactorial(k)));
+		}
+		__m256i bits = _mm256_slli_epi64(_mm256_add_epi64(_mm256_castpd_si256(t), _mm256_set1_epi64x(1023)), 52);
+		__m256d result = _mm256_mul_pd(p, _mm256_castsi256_pd(bits));
+		_mm256_storeu_pd(values + i, _mm256_and_pd(result, nonzero));
+	}
+	for (; i < count; i++) {
+		values[i] = approximateExp<D>(scale * values[i]);
+	}
+}
+
+#endif
+
+template<int D>
+static void scaledApproximateExp(fvalue scale, fvalue *values, size_t count) {
+#ifdef VECTOR_EXP
+	if constexpr (is_same<fvalue, double>::value) {
+		static bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+		if (avx2) {
+			scaledExpAvx2<D>(scale, values, count);
+			return;
+		}
+	}
+#endif
+	scaledExpScalar<D>(scale, values, count);
+}
+
+void scaledExp(fvalue scale, fvalue *values, size_t count, ExpAccuracy accuracy) {
+	if (accuracy == PRECISE_EXP) {
+		scaledApproximateExp<PRECISE_EXP_DEGREE>(scale, values, count);
+	} else if (accuracy == FAST_EXP) {
+		scaledApproximateExp<FAST_EXP_DEGREE>(scale, values, count);
+	} else {
+		for (size_t i = 0; i < count; i++) {
+			fvalue x = scale * values[i];
+			values[i] = x < EXP_ZERO ? 0.0 : exp(x);
+		}
+	}
+}
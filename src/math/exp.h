@@ -0,0 +1,85 @@
+/**************************************************************************
+ * This file is part of osvm, a Support Vector Machine solver.
+ * Copyright (C) 2012 Gabriella Melki (melkiga@vcu.edu), Vojislav Kecman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+#ifndef EXP_H_
+#define EXP_H_
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include "numeric.h"
+
+// exp of arguments below this rounds to zero
+#define EXP_ZERO -746.0
+// exp of arguments below this is a subnormal number or zero (taken as zero)
+#define EXP_UNDERFLOW -708.0
+// exp of arguments above this overflows
+#define EXP_OVERFLOW 709.0
+
+// degrees of the polynomials approximating exp on [-ln(2)/2, ln(2)/2]
+#define PRECISE_EXP_DEGREE 7
+#define FAST_EXP_DEGREE 4
+
+/*
+ * Accuracy of exp computed for whole kernel rows: as computed by the math
+ * library, with a relative error below 1e-8, or below 1e-4.
+ */
+enum ExpAccuracy {
+	EXACT_EXP,
+	PRECISE_EXP,
+	FAST_EXP
+};
+
+/*
+ * Replaces values[i] by exp(scale * values[i]) for i in [0, count).
+ */
+void scaledExp(fvalue scale, fvalue *values, size_t count, ExpAccuracy accuracy);
+
+inline constexpr double inverseFactorial(int k) {
+	return k == 0 ? 1.0 : inverseFactorial(k - 1) / k;
+}
+
+/*
+ * exp(x) = 2^n * exp(r), where n = round(x / ln(2)) and |r| <= ln(2) / 2. The
+ * rounding and 2^n are obtained from the bits of x / ln(2) + 1.5 * 2^52, exp(r)
+ * is the Taylor polynomial of degree D. Arguments below EXP_UNDERFLOW give 0.
+ */
+template<int D>
+inline double approximateExp(double x) {
+	const double shifter = 6755399441055744.0;
+	if (x < EXP_UNDERFLOW) {
+		return 0.0;
+	}
+	x = x > EXP_OVERFLOW ? EXP_OVERFLOW : x;
+	double t = x * M_LOG2E + shifter;
+	double n = t - shifter;
+	double r = (x - n * 0.693147180369123816490) - n * 1.90821492927058770002e-10;
+	double p = inverseFactorial(D);
+	for (int k = D - 1; k >= 0; k--) {
+		p = p * r + inverseFactorial(k);
+	}
+	uint64_t bits;
+	memcpy(&bits, &t, sizeof(double));
+	bits = (bits + 1023) << 52;
+	double power;
+	memcpy(&power, &bits, sizeof(double));
+	return p * power;
+}
+
+#endif
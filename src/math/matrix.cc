@@ -18,29 +18,445 @@
 
 #include "matrix.h"
 
-EvaluatorWorkspace::EvaluatorWorkspace(sfmatrix *matrix) {
-	buffer = new fvalue[matrix->width];
+#include <climits>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPARSE_GATHER
+#include <immintrin.h>
+#endif
+
+/*
+ * Computes the dot products of rows [rangeFrom, rangeTo) with the dense
+ * 'workspace' (the entries of every row are gathered from it). Compressed
+ * feature ids of every row are decoded to 'ids' first.
+ */
+template<typename S>
+using SparseDotKernel = void (*)(sfmatrix* matrix, const Decoded<S>* workspace, feature_id* ids,
+		sample_id rangeFrom, sample_id rangeTo, fvalue* buffer);
+
+template<typename S, typename A>
+static void sparseDotsScalar(sfmatrix* matrix, const Decoded<S>* workspace, feature_id* ids,
+		sample_id rangeFrom, sample_id rangeTo, fvalue* buffer) {
+	const S *values = sparseValues<S>(matrix);
+	for (sample_id u = rangeFrom; u < rangeTo; u++) {
+		offset_id offset = matrix->offsets[u];
+		const feature_id *iptr = matrix->rowFeatures(u, ids);
+		const S *fptr = values + offset;
+		quantity length = matrix->lengths[u];
+		A sum = 0.0;
+		for (quantity i = 0; i < length; i++) {
+			sum += (A) decode(fptr[i]) * (A) workspace[iptr[i]];
+		}
+		buffer[u] = (fvalue) sum;
+	}
+}
+
+#ifdef SPARSE_GATHER
+
+/*
+ * The vector kernels read whole padded rows (padding entries hold feature 0
+ * and value 0.0). Feature ids are passed to the gathers as signed 32-bit
+ * indices, so the kernels are used only for matrices narrower than INT_MAX.
+ * Single precision and compressed values are widened to double precision
+ * before being multiplied when the sums are kept in double precision. The
+ * products are computed in vectors but summed one by one in the order of the
+ * features, as in the scalar kernel, so that the dot product of two samples
+ * does not depend on which of them is scattered to the workspace (no fma, the
+ * products are rounded before being added).
+ * Gathers and widening conversions are written in their masked forms with
+ * zeroed sources (and all lanes selected), so that no undefined vector is read.
+ */
+#define ALL_LANES_PS128 _mm_castsi128_ps(_mm_set1_epi32(-1))
+#define ALL_LANES_PS _mm256_castsi256_ps(_mm256_set1_epi32(-1))
+#define ALL_LANES_PD _mm256_castsi256_pd(_mm256_set1_epi64x(-1))
+
+__attribute__((target("avx2,f16c")))
+static inline __m256d widen4(const float* values) {
+	return _mm256_cvtps_pd(_mm_loadu_ps(values));
+}
+
+__attribute__((target("avx2,f16c")))
+static inline __m256d widen4(const Half* values) {
+	return _mm256_cvtps_pd(_mm_cvtph_ps(_mm_loadl_epi64((const __m128i*) values)));
+}
+
+__attribute__((target("avx2,f16c")))
+static inline __m256d widen4(const BFloat16* values) {
+	__m128i bits = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*) values));
+	return _mm256_cvtps_pd(_mm_castsi128_ps(_mm_slli_epi32(bits, 16)));
+}
+
+__attribute__((target("avx2,f16c")))
+static inline __m256d widen4(const int8_t* values) {
+	int32_t packed;
+	memcpy(&packed, values, sizeof(int32_t));
+	return _mm256_cvtepi32_pd(_mm_cvtepi8_epi32(_mm_cvtsi32_si128(packed)));
+}
+
+__attribute__((target("avx512f,avx2,f16c")))
+static inline __m512d widen8(const float* values) {
+	return _mm512_maskz_cvtps_pd(0xff, _mm256_loadu_ps(values));
+}
+
+__attribute__((target("avx512f,avx2,f16c")))
+static inline __m512d widen8(const Half* values) {
+	return _mm512_maskz_cvtps_pd(0xff, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) values)));
+}
+
+__attribute__((target("avx512f,avx2,f16c")))
+static inline __m512d widen8(const BFloat16* values) {
+	__m256i bits = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) values));
+	return _mm512_maskz_cvtps_pd(0xff, _mm256_castsi256_ps(_mm256_slli_epi32(bits, 16)));
+}
+
+__attribute__((target("avx512f,avx2,f16c")))
+static inline __m512d widen8(const int8_t* values) {
+	return _mm512_maskz_cvtepi32_pd(0xff, _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*) values)));
+}
+
+/*
+ * Feature ids of row u for the vector kernels. Compressed ids with single byte
+ * gaps (the common case) are decoded by prefix sums of 8 gaps at a time.
+ */
+__attribute__((target("avx2")))
+static inline const int* rowFeaturesAvx2(sfmatrix* matrix, sample_id u, feature_id* ids) {
+	const uint8_t *bytes = matrix->indices ? matrix->indices + matrix->indexOffsets[u] : NULL;
+	quantity length = matrix->lengths[u];
+	if (bytes == NULL || bytes[0] != 1 || length == 0) {
+		return (const int*) matrix->rowFeatures(u, ids);
+	}
+	const uint8_t *gaps = bytes + 1 + sizeof(feature_id);
+	memcpy(ids, bytes + 1, sizeof(feature_id));
+	__m256i last = _mm256_set1_epi32((int) ids[0]);
+	quantity i = 1;
+	for (; i + 8 <= length; i += 8) {
+		__m256i sums = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (gaps + i - 1)));
+		sums = _mm256_add_epi32(sums, _mm256_slli_si256(sums, 4));
+		sums = _mm256_add_epi32(sums, _mm256_slli_si256(sums, 8));
+		__m256i carry = _mm256_permutevar8x32_epi32(sums, _mm256_set1_epi32(3));
+		sums = _mm256_add_epi32(sums, _mm256_blend_epi32(_mm256_setzero_si256(), carry, 0xf0));
+		sums = _mm256_add_epi32(sums, last);
+		_mm256_storeu_si256((__m256i*) (ids + i), sums);
+		last = _mm256_permutevar8x32_epi32(sums, _mm256_set1_epi32(7));
+	}
+	feature_id id = (feature_id) _mm256_cvtsi256_si32(last);
+	for (; i < length; i++) {
+		id += gaps[i - 1];
+		ids[i] = id;
+	}
+	for (; i < padRow(length); i++) {
+		ids[i] = 0;
+	}
+	return (const int*) ids;
+}
+
+/*
+ * The products of the features shared with the sample scattered to the
+ * workspace (the others are zeros) are packed in a small buffer in the order
+ * of the features, and added to the sum once it holds SPARSE_PACKED_PRODUCTS.
+ */
+#define SPARSE_PACKED_PRODUCTS 16
+
+template<typename A>
+static inline A addProducts(A sum, const A* products, quantity count) {
+	for (quantity i = 0; i < count; i++) {
+		sum += products[i];
+	}
+	return sum;
+}
+
+/*
+ * Appends the lanes set in 'mask' to the packed products (without branches).
+ */
+template<typename A>
+static inline quantity packLanes(A* packed, quantity count, const A* products, unsigned mask, quantity lanes) {
+	for (quantity lane = 0; lane < lanes; lane++) {
+		packed[count] = products[lane];
+		count += (mask >> lane) & 1;
+	}
+	return count;
+}
+
+template<typename S, typename A>
+__attribute__((target("avx2,f16c")))
+static void sparseDotsAvx2(sfmatrix* matrix, const Decoded<S>* workspace, feature_id* ids,
+		sample_id rangeFrom, sample_id rangeTo, fvalue* buffer) {
+	const S *values = sparseValues<S>(matrix);
+	A products[8];
+	A packed[SPARSE_PACKED_PRODUCTS + 8];
+	for (sample_id u = rangeFrom; u < rangeTo; u++) {
+		offset_id offset = matrix->offsets[u];
+		const int *iptr = rowFeaturesAvx2(matrix, u, ids);
+		const S *fptr = values + offset;
+		quantity length = (quantity) padRow(matrix->lengths[u]);
+		quantity i = 0;
+		quantity count = 0;
+		A sum = 0.0;
+		if constexpr (is_same<A, float>::value) {
+			for (; i + 8 <= length; i += 8) {
+				__m256i idx = _mm256_loadu_si256((const __m256i*) (iptr + i));
+				__m256 gathered = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), workspace, idx, ALL_LANES_PS, 4);
+				unsigned mask = (unsigned) _mm256_movemask_ps(_mm256_cmp_ps(gathered, _mm256_setzero_ps(), _CMP_NEQ_OQ));
+				_mm256_storeu_ps(products, _mm256_mul_ps(_mm256_loadu_ps(fptr + i), gathered));
+				count = packLanes(packed, count, products, mask, 8);
+				if (count >= SPARSE_PACKED_PRODUCTS) {
+					sum = addProducts(sum, packed, count);
+					count = 0;
+				}
+			}
+			if (i < length) {
+				__m128i idx = _mm_loadu_si128((const __m128i*) (iptr + i));
+				__m128 gathered = _mm_mask_i32gather_ps(_mm_setzero_ps(), workspace, idx, ALL_LANES_PS128, 4);
+				unsigned mask = (unsigned) _mm_movemask_ps(_mm_cmp_ps(gathered, _mm_setzero_ps(), _CMP_NEQ_OQ));
+				_mm_storeu_ps(products, _mm_mul_ps(_mm_loadu_ps(fptr + i), gathered));
+				count = packLanes(packed, count, products, mask, 4);
+			}
+		} else {
+			for (; i < length; i += 4) {
+				__m128i idx = _mm_loadu_si128((const __m128i*) (iptr + i));
+				__m256d x;
+				__m256d gathered;
+				if constexpr (is_same<S, double>::value) {
+					x = _mm256_loadu_pd(fptr + i);
+					gathered = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), workspace, idx, ALL_LANES_PD, 8);
+				} else {
+					x = widen4(fptr + i);
+					gathered = _mm256_cvtps_pd(_mm_mask_i32gather_ps(_mm_setzero_ps(), workspace, idx, ALL_LANES_PS128, 4));
+				}
+				unsigned mask = (unsigned) _mm256_movemask_pd(_mm256_cmp_pd(gathered, _mm256_setzero_pd(), _CMP_NEQ_OQ));
+				_mm256_storeu_pd(products, _mm256_mul_pd(x, gathered));
+				count = packLanes(packed, count, products, mask, 4);
+				if (count >= SPARSE_PACKED_PRODUCTS) {
+					sum = addProducts(sum, packed, count);
+					count = 0;
+				}
+			}
+		}
+		buffer[u] = (fvalue) addProducts(sum, packed, count);
+	}
+}
+
+template<typename S, typename A>
+__attribute__((target("avx512f,avx2,f16c")))
+static void sparseDotsAvx512(sfmatrix* matrix, const Decoded<S>* workspace, feature_id* ids,
+		sample_id rangeFrom, sample_id rangeTo, fvalue* buffer) {
+	const S *values = sparseValues<S>(matrix);
+	A packed[SPARSE_PACKED_PRODUCTS + 16];
+	for (sample_id u = rangeFrom; u < rangeTo; u++) {
+		offset_id offset = matrix->offsets[u];
+		const int *iptr = rowFeaturesAvx2(matrix, u, ids);
+		const S *fptr = values + offset;
+		quantity length = (quantity) padRow(matrix->lengths[u]);
+		quantity i = 0;
+		quantity count = 0;
+		A sum = 0.0;
+		if constexpr (is_same<A, float>::value) {
+			for (; i < length; i += 16) {
+				__mmask16 lanes = i + 16 <= length ? (__mmask16) 0xffff : (__mmask16) ((1u << (length - i)) - 1);
+				__m512i idx = _mm512_maskz_loadu_epi32(lanes, iptr + i);
+				__m512 gathered = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), lanes, idx, workspace, 4);
+				__mmask16 mask = _mm512_cmp_ps_mask(gathered, _mm512_setzero_ps(), _CMP_NEQ_OQ);
+				__m512 products = _mm512_mul_ps(_mm512_maskz_loadu_ps(lanes, fptr + i), gathered);
+				_mm512_storeu_ps(packed + count, _mm512_maskz_compress_ps(mask, products));
+				count += (quantity) __builtin_popcount(mask);
+				if (count >= SPARSE_PACKED_PRODUCTS) {
+					sum = addProducts(sum, packed, count);
+					count = 0;
+				}
+			}
+		} else {
+			for (; i < length; i += 8) {
+				__mmask8 lanes = i + 8 <= length ? (__mmask8) 0xff : (__mmask8) ((1u << (length - i)) - 1);
+				__m256i idx = _mm256_maskload_epi32(iptr + i, _mm256_cmpgt_epi32(_mm256_set1_epi32((int) (length - i)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+				__m512d x;
+				__m512d gathered;
+				if constexpr (is_same<S, double>::value) {
+					x = _mm512_maskz_loadu_pd(lanes, fptr + i);
+					gathered = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), lanes, idx, workspace, 8);
+				} else if (lanes == 0xff) {
+					x = widen8(fptr + i);
+					gathered = _mm512_maskz_cvtps_pd(0xff, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), workspace, idx, ALL_LANES_PS, 4));
+				} else {
+					// the rows are padded to 4 entries (half a vector)
+					x = _mm512_maskz_insertf64x4(0xff, _mm512_setzero_pd(), widen4(fptr + i), 0);
+					gathered = _mm512_maskz_insertf64x4(0xff, _mm512_setzero_pd(),
+							_mm256_cvtps_pd(_mm_mask_i32gather_ps(_mm_setzero_ps(), workspace, _mm256_castsi256_si128(idx), ALL_LANES_PS128, 4)), 0);
+				}
+				__mmask8 mask = _mm512_cmp_pd_mask(gathered, _mm512_setzero_pd(), _CMP_NEQ_OQ);
+				__m512d products = _mm512_mul_pd(x, gathered);
+				_mm512_storeu_pd(packed + count, _mm512_maskz_compress_pd(mask, products));
+				count += (quantity) __builtin_popcount(mask);
+				if (count >= SPARSE_PACKED_PRODUCTS) {
+					sum = addProducts(sum, packed, count);
+					count = 0;
+				}
+			}
+		}
+		buffer[u] = (fvalue) addProducts(sum, packed, count);
+	}
+}
+
+#endif
+
+template<typename S, typename A>
+static SparseDotKernel<S> selectSparseDotKernel() {
+#ifdef SPARSE_GATHER
+	__builtin_cpu_init();
+	bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+	if (avx2 && __builtin_cpu_supports("avx512f")) {
+		return sparseDotsAvx512<S, A>;
+	}
+	if (avx2) {
+		return sparseDotsAvx2<S, A>;
+	}
+#endif
+	return sparseDotsScalar<S, A>;
+}
+
+/*
+ * Computes the number of features rows [rangeFrom, rangeTo) of the bit matrix
+ * share with the bit row 'sample'.
+ */
+using BinaryDotKernel = void (*)(bmatrix* bits, const uint64_t* sample,
+		sample_id rangeFrom, sample_id rangeTo, fvalue* buffer);
+
+static inline __attribute__((always_inline)) void binaryDots(bmatrix* bits, const uint64_t* sample,
+		sample_id rangeFrom, sample_id rangeTo, fvalue* buffer) {
+	size_t stride = bits->stride;
+	for (sample_id u = rangeFrom; u < rangeTo; u++) {
+		const uint64_t *row = bits->row(u);
+		quantity common = 0;
+		for (size_t i = 0; i < stride; i++) {
+			common += (quantity) __builtin_popcountll(row[i] & sample[i]);
+		}
+		buffer[u] = common;
+	}
+}
+
+static void binaryDotsScalar(bmatrix* bits, const uint64_t* sample,
+		sample_id rangeFrom, sample_id rangeTo, fvalue* buffer) {
+	binaryDots(bits, sample, rangeFrom, rangeTo, buffer);
+}
+
+#ifdef SPARSE_GATHER
+
+__attribute__((target("popcnt")))
+static void binaryDotsPopcnt(bmatrix* bits, const uint64_t* sample,
+		sample_id rangeFrom, sample_id rangeTo, fvalue* buffer) {
+	binaryDots(bits, sample, rangeFrom, rangeTo, buffer);
+}
+
+#endif
+
+static BinaryDotKernel selectBinaryDotKernel() {
+#ifdef SPARSE_GATHER
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("popcnt")) {
+		return binaryDotsPopcnt;
+	}
+#endif
+	return binaryDotsScalar;
+}
+
+template<typename S>
+EvaluatorWorkspace<S>::EvaluatorWorkspace(sfmatrix *matrix) {
+	buffer = new S[matrix->width];
 	for (size_t i = 0; i < matrix->width; i++) {
 		buffer[i] = 0;
 	}
 }
 
-EvaluatorWorkspace::~EvaluatorWorkspace() {
+template<typename S>
+EvaluatorWorkspace<S>::~EvaluatorWorkspace() {
 	delete [] buffer;
 }
 
 MatrixEvaluator::MatrixEvaluator(sfmatrix* matrix) :
-  matrix(matrix),
-  workspace(matrix) {
-  quantity length = getSize(matrix);
-  x2 = new fvalue[length];
-  for (sample_id id = 0; id < length; id++) {
-    x2[id] = squaredNorm(id);
-  }
+  matrix(matrix) {
+  computeNorms(matrix);
+  x2 = matrix->norms;
 }
 
 MatrixEvaluator::~MatrixEvaluator() {
-  delete[] x2;
+}
+
+/*
+* Creates the evaluator of samples stored in CSR format only.
+*/
+template<typename S, typename A>
+static MatrixEvaluator* createSparseEvaluator(sfmatrix* matrix) {
+  if (InvertedIndexMatrixEvaluator<S, A>::isSuitable(matrix)) {
+    return new InvertedIndexMatrixEvaluator<S, A>(matrix);
+  }
+  return new SparseMatrixEvaluator<S, A>(matrix);
+}
+
+/*
+* Creates the evaluator of densified samples with the row stride fixed at
+* compile time (N, N + DENSE_LANES, ... up to FIXED_STRIDE_LIMIT) if possible.
+*/
+template<typename S, typename A, size_t N>
+static MatrixEvaluator* createDenseEvaluator(sfmatrix* matrix) {
+  if constexpr (N <= FIXED_STRIDE_LIMIT) {
+    if (matrix->dense->stride == N) {
+      return new DenseMatrixEvaluator<S, A, N>(matrix);
+    }
+    return createDenseEvaluator<S, A, N + DENSE_LANES>(matrix);
+  } else {
+    return new DenseMatrixEvaluator<S, A>(matrix);
+  }
+}
+
+/*
+* Creates the evaluator matching the representation of the samples.
+*/
+template<typename S, typename A>
+static MatrixEvaluator* createEvaluator(sfmatrix* matrix) {
+  if (matrix->dense && matrix->offsets) {
+    return new HybridMatrixEvaluator<S, A>(matrix);
+  }
+  if (matrix->dense) {
+    return createDenseEvaluator<S, A, DENSE_LANES>(matrix);
+  }
+  return createSparseEvaluator<S, A>(matrix);
+}
+
+/*
+* Creates the evaluator matching the representation and precision of the samples.
+*/
+MatrixEvaluator* MatrixEvaluator::create(sfmatrix* matrix) {
+  if (matrix->bits) {
+    return new BinaryMatrixEvaluator(matrix);
+  }
+  switch (matrix->precision) {
+  case FLOAT_PRECISION:
+    return createEvaluator<float, float>(matrix);
+  case MIXED_PRECISION:
+    return createEvaluator<float, double>(matrix);
+  case HALF_PRECISION:
+    return createSparseEvaluator<Half, double>(matrix);
+  case BFLOAT16_PRECISION:
+    return createSparseEvaluator<BFloat16, double>(matrix);
+  case INT8_PRECISION:
+    return createSparseEvaluator<int8_t, double>(matrix);
+  default:
+    return createEvaluator<fvalue, double>(matrix);
+  }
+}
+
+/*
+* Fills in the squared norms of the matrix rows unless they are already known
+* (e.g. when the matrix was loaded from a binary data file).
+*/
+void MatrixEvaluator::computeNorms(sfmatrix* matrix) {
+  if (matrix->norms == NULL) {
+    quantity length = (quantity) matrix->height;
+    matrix->norms = new fvalue[length];
+    for (sample_id id = 0; id < length; id++) {
+      matrix->norms[id] = squaredNorm(matrix, id);
+    }
+  }
 }
 
 void MatrixEvaluator::dist(sample_id id, sample_id rangeFrom, sample_id rangeTo, sample_id* mappings, fvector* buffer) {
@@ -58,78 +474,474 @@ fvalue MatrixEvaluator::dist(sample_id u, sample_id v) {
   return x2[u] + x2[v] - 2 * dot(u, v);
 }
 
-fvalue MatrixEvaluator::dot(sample_id u, sample_id v) {
-	id uoffset = matrix->offsets[u];
-	feature_id *iuptr = matrix->features + uoffset;
-	fvalue *fuptr = matrix->values + uoffset;
-
-	id voffset = matrix->offsets[v];
-	feature_id *ivptr = matrix->features + voffset;
-	fvalue *fvptr = matrix->values + voffset;
+/*
+* Adds the squares of the sparse values of sample u stored as S to the sum (kept in the working precision).
+*/
+template<typename S>
+static fvalue addSquares(fvalue sum, sfmatrix* matrix, sample_id u) {
+	offset_id offset = matrix->offsets[u];
+	vector<feature_id> ids(matrix->indices ? padRow(matrix->lengths[u]) : 0);
+	feature_id *iptr = matrix->rowFeatures(u, ids.data());
+	S *fptr = sparseValues<S>(matrix) + offset;
+	quantity length = matrix->lengths[u];
+	for (quantity i = 0; i < length; i++) {
+		sum += pow2((fvalue) sampleValue(matrix, fptr[i], iptr[i]));
+	}
+	return sum;
+}
 
+/*
+* Calculates the squared norm of sample u (summing its dense and sparse parts)
+*/
+fvalue MatrixEvaluator::squaredNorm(sfmatrix* matrix, sample_id u) {
+	if (matrix->bits) {
+		return matrix->bits->count(u);
+	}
 	fvalue sum = 0.0;
-	while (*iuptr != INVALID_FEATURE_ID && *ivptr != INVALID_FEATURE_ID) {
-		while (*iuptr < *ivptr) {
+	dfmatrix *dense = matrix->dense;
+	if (dense) {
+		if (dense->singles) {
+			float *row = dense->singleRow(u);
+			sum = denseDot<float, fvalue>(row, row, dense->stride);
+		} else {
+			fvalue *row = dense->row(u);
+			sum = denseDot<fvalue, fvalue>(row, row, dense->stride);
+		}
+	}
+	if (matrix->offsets == NULL) {
+		return sum;
+	}
+
+	switch (matrix->precision) {
+	case HALF_PRECISION:
+		return addSquares<Half>(sum, matrix, u);
+	case BFLOAT16_PRECISION:
+		return addSquares<BFloat16>(sum, matrix, u);
+	case INT8_PRECISION:
+		return addSquares<int8_t>(sum, matrix, u);
+	default:
+		return matrix->singles ? addSquares<float>(sum, matrix, u) : addSquares<fvalue>(sum, matrix, u);
+	}
+}
+
+template<typename S, typename A>
+SparseMatrixEvaluator<S, A>::SparseMatrixEvaluator(sfmatrix* matrix) :
+  MatrixEvaluator(matrix),
+  workspace(matrix),
+  rowIds(NULL),
+  sampleIds(NULL) {
+  lengths = matrix->lengths;
+  if (matrix->indices) {
+    quantity length = (quantity) padRow(matrix->getMaxLength());
+    rowIds = new feature_id[length];
+    sampleIds = new feature_id[length];
+  }
+}
+
+template<typename S, typename A>
+SparseMatrixEvaluator<S, A>::~SparseMatrixEvaluator() {
+  delete [] rowIds;
+  delete [] sampleIds;
+}
+
+template<typename S, typename A>
+void SparseMatrixEvaluator<S, A>::dots(sample_id rangeFrom, sample_id rangeTo, fvalue* buffer) {
+	static SparseDotKernel<S> kernel = selectSparseDotKernel<S, A>();
+	if (matrix->width < (size_t) INT_MAX) {
+		kernel(matrix, workspace.buffer, rowIds, rangeFrom, rangeTo, buffer);
+	} else {
+		sparseDotsScalar<S, A>(matrix, workspace.buffer, rowIds, rangeFrom, rangeTo, buffer);
+	}
+}
+
+template<typename S, typename A>
+fvalue SparseMatrixEvaluator<S, A>::dot(sample_id u, sample_id v) {
+	S *values = sparseValues<S>(matrix);
+
+	offset_id uoffset = matrix->offsets[u];
+	feature_id *iuptr = matrix->rowFeatures(u, rowIds);
+	S *fuptr = values + uoffset;
+	feature_id *iuend = iuptr + lengths[u];
+
+	offset_id voffset = matrix->offsets[v];
+	feature_id *ivptr = matrix->rowFeatures(v, sampleIds);
+	S *fvptr = values + voffset;
+	feature_id *ivend = ivptr + lengths[v];
+
+	A sum = 0.0;
+	while (iuptr < iuend && ivptr < ivend) {
+		while (iuptr < iuend && *iuptr < *ivptr) {
 			iuptr++;
 			fuptr++;
 		}
-		if (*iuptr == *ivptr) {
-			sum += *fuptr * *fvptr;
+		if (iuptr < iuend && *iuptr == *ivptr) {
+			sum += (A) decode(*fuptr) * (A) workspaceValue(matrix, *fvptr, *ivptr);
 			iuptr++;
 			fuptr++;
 		}
 		swap(iuptr, ivptr);
+		swap(iuend, ivend);
 		swap(fuptr, fvptr);
 	}
-	return sum;
+	return (fvalue) sum;
 }
 
-/*
-* Calculates the squared norm of sample u for samples stored in sparse format
-*/
-fvalue MatrixEvaluator::squaredNorm(sample_id u) {
-	fvalue sum = 0.0;
-	id offset = matrix->offsets[u];
-	feature_id *iptr = matrix->features + offset;
-	fvalue *fptr = matrix->values + offset;
-	while (*iptr++ != INVALID_FEATURE_ID) {
-		sum += pow2(*fptr++);
-	}
-	return sum;
-}
-
-void MatrixEvaluator::dist(sample_id v, sample_id rangeFrom, sample_id rangeTo, fvector *buffer) {
+template<typename S, typename A>
+void SparseMatrixEvaluator<S, A>::dist(sample_id v, sample_id rangeFrom, sample_id rangeTo, fvector *buffer) {
 	// setup workspace
-	id offset = matrix->offsets[v];
-	feature_id *iptr = matrix->features + offset;
-	fvalue *fptr = matrix->values + offset;
-	while (*iptr != INVALID_FEATURE_ID) {
-		workspace.buffer[*iptr++] = *fptr++;
+	offset_id offset = matrix->offsets[v];
+	feature_id *iptr = matrix->rowFeatures(v, sampleIds);
+	S *fptr = sparseValues<S>(matrix) + offset;
+	quantity length = lengths[v];
+	for (quantity i = 0; i < length; i++) {
+		workspace.buffer[iptr[i]] = workspaceValue(matrix, fptr[i], iptr[i]);
 	}
 
-	// calculate dists
+	// calculate dists (blocks of rows are announced to out-of-core storages)
 	fvalue *x2ptr = x2;
 	fvalue v2 = x2ptr[v];
 	fvalue *fbuffer = buffer->data;
-	for (sample_id offst = rangeFrom; offst < rangeTo; offst++) {
-		id coffset = matrix->offsets[offst];
-		feature_id *icptr = matrix->features + coffset;
-		fvalue *fcptr = matrix->values + coffset;
-		fvalue sum = 0.0;
-		while (*icptr != INVALID_FEATURE_ID) {
-			sum += *fcptr++ * workspace.buffer[*icptr++];
+	for (sample_id block = rangeFrom; block < rangeTo; block += PREFETCH_ROWS) {
+		sample_id blockEnd = min(block + PREFETCH_ROWS, rangeTo);
+		if (matrix->storage) {
+			matrix->storage->prefetch(block, blockEnd);
+		}
+		dots(block, blockEnd, fbuffer);
+		for (sample_id offst = block; offst < blockEnd; offst++) {
+			fbuffer[offst] = x2ptr[offst] + v2 - 2.0 * fbuffer[offst];
 		}
-		fbuffer[offst] = x2ptr[offst] + v2 - 2.0 * sum;
 	}
 
 	// clear workspace
-	iptr = matrix->features + offset;
-	while (*iptr != INVALID_FEATURE_ID) {
-		workspace.buffer[*iptr++] = 0.0;
+	for (quantity i = 0; i < length; i++) {
+		workspace.buffer[iptr[i]] = 0.0;
 	}
 }
 
-void MatrixEvaluator::swapSamples(sample_id u, sample_id v) {
+template<typename S, typename A>
+void SparseMatrixEvaluator<S, A>::swapSamples(sample_id u, sample_id v) {
 	swap(matrix->offsets[u], matrix->offsets[v]);
+	swap(lengths[u], lengths[v]);
+	swap(x2[u], x2[v]);
+	if (matrix->indices) {
+		swap(matrix->indexOffsets[u], matrix->indexOffsets[v]);
+	}
+}
+
+template<typename S, typename A>
+InvertedIndexMatrixEvaluator<S, A>::InvertedIndexMatrixEvaluator(sfmatrix* matrix) :
+	SparseMatrixEvaluator<S, A>(matrix) {
+	size_t height = matrix->height;
+	size_t width = matrix->width;
+	quantity *lengths = this->lengths;
+	S *values = sparseValues<S>(matrix);
+
+	// count the entries of every column first, then fill the posting lists
+	postingOffsets = new offset_id[width + 1];
+	fill(postingOffsets, postingOffsets + width + 1, 0);
+	entries = 0;
+	for (sample_id u = 0; u < height; u++) {
+		feature_id *iptr = matrix->rowFeatures(u, this->rowIds);
+		for (quantity i = 0; i < lengths[u]; i++) {
+			postingOffsets[iptr[i] + 1]++;
+		}
+		entries += lengths[u];
+	}
+	for (size_t feature = 0; feature < width; feature++) {
+		postingOffsets[feature + 1] += postingOffsets[feature];
+	}
+
+	postingSamples = new sample_id[entries];
+	postingValues = new S[entries];
+	vector<offset_id> ends(postingOffsets, postingOffsets + width);
+	for (sample_id u = 0; u < height; u++) {
+		offset_id offset = matrix->offsets[u];
+		feature_id *iptr = matrix->rowFeatures(u, this->rowIds);
+		S *fptr = values + offset;
+		for (quantity i = 0; i < lengths[u]; i++) {
+			offset_id entry = ends[iptr[i]]++;
+			postingSamples[entry] = u;
+			postingValues[entry] = fptr[i];
+		}
+	}
+
+	positions = new sample_id[height];
+	originals = new sample_id[height];
+	for (sample_id u = 0; u < height; u++) {
+		positions[u] = u;
+		originals[u] = u;
+	}
+	shared = false;
+}
+
+/*
+ * Only the workspace is allocated, the posting lists and the positions of the
+ * samples are read from the other evaluator.
+ */
+template<typename S, typename A>
+InvertedIndexMatrixEvaluator<S, A>::InvertedIndexMatrixEvaluator(InvertedIndexMatrixEvaluator<S, A>* index) :
+	SparseMatrixEvaluator<S, A>(index->matrix),
+	postingOffsets(index->postingOffsets),
+	postingSamples(index->postingSamples),
+	postingValues(index->postingValues),
+	positions(index->positions),
+	originals(index->originals),
+	entries(index->entries),
+	shared(true) {
+}
+
+template<typename S, typename A>
+InvertedIndexMatrixEvaluator<S, A>::~InvertedIndexMatrixEvaluator() {
+	if (!shared) {
+		delete [] postingOffsets;
+		delete [] postingSamples;
+		delete [] postingValues;
+		delete [] positions;
+		delete [] originals;
+	}
+}
+
+/*
+ * The index takes about as much memory as the samples, so it is built only for
+ * very sparse data kept in memory.
+ */
+template<typename S, typename A>
+bool InvertedIndexMatrixEvaluator<S, A>::isSuitable(sfmatrix* matrix) {
+	if (matrix->offsets == NULL || (matrix->storage && !matrix->storage->isResident())) {
+		return false;
+	}
+	double entries = 0.0;
+	for (sample_id u = 0; u < matrix->height; u++) {
+		entries += matrix->lengths[u];
+	}
+	return entries <= INVERTED_INDEX_DENSITY * matrix->height * matrix->width;
+}
+
+/*
+ * The posting lists are read when they hold fewer entries (weighted by the
+ * cost of scattered accumulation) than the rows of the range are expected to.
+ */
+template<typename S, typename A>
+void InvertedIndexMatrixEvaluator<S, A>::dist(sample_id v, sample_id rangeFrom, sample_id rangeTo, fvector *buffer) {
+	sfmatrix *matrix = this->matrix;
+	feature_id *iptr = matrix->rowFeatures(v, this->sampleIds);
+	double postings = 0.0;
+	for (quantity i = 0; i < this->lengths[v]; i++) {
+		postings += postingOffsets[iptr[i] + 1] - postingOffsets[iptr[i]];
+	}
+	double rows = (double) entries * (rangeTo - rangeFrom) / matrix->height;
+	if (INVERTED_INDEX_COST * postings < rows) {
+		postingDists(v, rangeFrom, rangeTo, buffer);
+	} else {
+		SparseMatrixEvaluator<S, A>::dist(v, rangeFrom, rangeTo, buffer);
+	}
+}
+
+/*
+ * The features of v are visited in increasing order, so every dot product is
+ * summed in the same order (and in the same precision) as when reading the rows.
+ */
+template<typename S, typename A>
+void InvertedIndexMatrixEvaluator<S, A>::postingDists(sample_id v, sample_id rangeFrom, sample_id rangeTo, fvector *buffer) {
+	sfmatrix *matrix = this->matrix;
+	fvalue *fbuffer = buffer->data;
+	fill(fbuffer + rangeFrom, fbuffer + rangeTo, 0.0);
+
+	offset_id offset = matrix->offsets[v];
+	feature_id *iptr = matrix->rowFeatures(v, this->sampleIds);
+	S *fptr = sparseValues<S>(matrix) + offset;
+	for (quantity i = 0; i < this->lengths[v]; i++) {
+		A value = workspaceValue(matrix, fptr[i], iptr[i]);
+		offset_id end = postingOffsets[iptr[i] + 1];
+		for (offset_id entry = postingOffsets[iptr[i]]; entry < end; entry++) {
+			sample_id u = positions[postingSamples[entry]];
+			if (u >= rangeFrom && u < rangeTo) {
+				fbuffer[u] = (A) fbuffer[u] + (A) decode(postingValues[entry]) * value;
+			}
+		}
+	}
+
+	fvalue *x2 = this->x2;
+	fvalue v2 = x2[v];
+	for (sample_id u = rangeFrom; u < rangeTo; u++) {
+		fbuffer[u] = x2[u] + v2 - 2.0 * fbuffer[u];
+	}
+}
+
+template<typename S, typename A>
+void InvertedIndexMatrixEvaluator<S, A>::swapSamples(sample_id u, sample_id v) {
+	SparseMatrixEvaluator<S, A>::swapSamples(u, v);
+	swap(originals[u], originals[v]);
+	positions[originals[u]] = u;
+	positions[originals[v]] = v;
+}
+
+template<typename S, typename A, size_t N>
+DenseMatrixEvaluator<S, A, N>::DenseMatrixEvaluator(sfmatrix* matrix) :
+  MatrixEvaluator(matrix),
+  dense(matrix->dense) {
+}
+
+template<typename S, typename A, size_t N>
+fvalue DenseMatrixEvaluator<S, A, N>::dot(sample_id u, sample_id v) {
+	return denseDot<S, A>(denseRow<S>(dense, u), denseRow<S>(dense, v), N > 0 ? N : dense->stride);
+}
+
+/*
+ * Distances of rows [rangeFrom, rangeTo) to sample v (rows of N values, or of
+ * the stride of the matrix if N is 0).
+ */
+template<typename S, typename A, size_t N>
+static inline __attribute__((always_inline)) void denseDists(dfmatrix* dense, fvalue* x2, sample_id v,
+		sample_id rangeFrom, sample_id rangeTo, fvalue* buffer) {
+	S *vrow = denseRow<S>(dense, v);
+	fvalue v2 = x2[v];
+	size_t stride = N > 0 ? N : dense->stride;
+	for (sample_id u = rangeFrom; u < rangeTo; u++) {
+		buffer[u] = x2[u] + v2 - 2.0 * denseDot<S, A>(denseRow<S>(dense, u), vrow, stride);
+	}
+}
+
+template<typename S, typename A, size_t N>
+static void denseDistsScalar(dfmatrix* dense, fvalue* x2, sample_id v,
+		sample_id rangeFrom, sample_id rangeTo, fvalue* buffer) {
+	denseDists<S, A, N>(dense, x2, v, rangeFrom, rangeTo, buffer);
+}
+
+#ifdef SPARSE_GATHER
+
+// no fma, so that the sums are rounded as in the other kernels
+template<typename S, typename A, size_t N>
+__attribute__((target("avx2")))
+static void denseDistsAvx2(dfmatrix* dense, fvalue* x2, sample_id v,
+		sample_id rangeFrom, sample_id rangeTo, fvalue* buffer) {
+	denseDists<S, A, N>(dense, x2, v, rangeFrom, rangeTo, buffer);
+}
+
+#endif
+
+template<typename S, typename A, size_t N>
+void DenseMatrixEvaluator<S, A, N>::dist(sample_id v, sample_id rangeFrom, sample_id rangeTo, fvector *buffer) {
+#ifdef SPARSE_GATHER
+	static bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+	if (avx2) {
+		denseDistsAvx2<S, A, N>(dense, x2, v, rangeFrom, rangeTo, buffer->data);
+		return;
+	}
+#endif
+	denseDistsScalar<S, A, N>(dense, x2, v, rangeFrom, rangeTo, buffer->data);
+}
+
+/*
+* Rows are swapped physically, so that they are always read in order.
+*/
+template<typename S, typename A, size_t N>
+void DenseMatrixEvaluator<S, A, N>::swapSamples(sample_id u, sample_id v) {
+	dense->swapRows(u, v);
 	swap(x2[u], x2[v]);
 }
+
+template<typename S, typename A>
+HybridMatrixEvaluator<S, A>::HybridMatrixEvaluator(sfmatrix* matrix) :
+  SparseMatrixEvaluator<S, A>(matrix),
+  dense(matrix->dense) {
+}
+
+template<typename S, typename A>
+fvalue HybridMatrixEvaluator<S, A>::dot(sample_id u, sample_id v) {
+	return denseDot<S, A>(denseRow<S>(dense, u), denseRow<S>(dense, v), dense->stride)
+			+ SparseMatrixEvaluator<S, A>::dot(u, v);
+}
+
+template<typename S, typename A>
+void HybridMatrixEvaluator<S, A>::dist(sample_id v, sample_id rangeFrom, sample_id rangeTo, fvector *buffer) {
+	// setup workspace (sparse part only)
+	sfmatrix *matrix = this->matrix;
+	S *workspace = this->workspace.buffer;
+	offset_id offset = matrix->offsets[v];
+	feature_id *iptr = matrix->rowFeatures(v, this->sampleIds);
+	S *fptr = sparseValues<S>(matrix) + offset;
+	quantity length = this->lengths[v];
+	for (quantity i = 0; i < length; i++) {
+		workspace[iptr[i]] = workspaceValue(matrix, fptr[i], iptr[i]);
+	}
+
+	S *vrow = denseRow<S>(dense, v);
+	fvalue *x2 = this->x2;
+	fvalue v2 = x2[v];
+	fvalue *fbuffer = buffer->data;
+	size_t stride = dense->stride;
+	this->dots(rangeFrom, rangeTo, fbuffer);
+	for (sample_id u = rangeFrom; u < rangeTo; u++) {
+		fvalue sum = denseDot<S, A>(denseRow<S>(dense, u), vrow, stride) + fbuffer[u];
+		fbuffer[u] = x2[u] + v2 - 2.0 * sum;
+	}
+
+	// clear workspace
+	for (quantity i = 0; i < length; i++) {
+		workspace[iptr[i]] = 0.0;
+	}
+}
+
+template<typename S, typename A>
+void HybridMatrixEvaluator<S, A>::swapSamples(sample_id u, sample_id v) {
+	SparseMatrixEvaluator<S, A>::swapSamples(u, v);
+	dense->swapRows(u, v);
+}
+
+BinaryMatrixEvaluator::BinaryMatrixEvaluator(sfmatrix* matrix) :
+  MatrixEvaluator(matrix),
+  bits(matrix->bits) {
+}
+
+fvalue BinaryMatrixEvaluator::dot(sample_id u, sample_id v) {
+	uint64_t *urow = bits->row(u);
+	uint64_t *vrow = bits->row(v);
+	quantity common = 0;
+	for (size_t i = 0; i < bits->stride; i++) {
+		common += (quantity) __builtin_popcountll(urow[i] & vrow[i]);
+	}
+	return common;
+}
+
+void BinaryMatrixEvaluator::dist(sample_id v, sample_id rangeFrom, sample_id rangeTo, fvector *buffer) {
+	static BinaryDotKernel kernel = selectBinaryDotKernel();
+	fvalue v2 = x2[v];
+	fvalue *fbuffer = buffer->data;
+	kernel(bits, bits->row(v), rangeFrom, rangeTo, fbuffer);
+	for (sample_id u = rangeFrom; u < rangeTo; u++) {
+		fbuffer[u] = x2[u] + v2 - 2.0 * fbuffer[u];
+	}
+}
+
+/*
+* Rows are swapped physically, so that they are always read in order.
+*/
+void BinaryMatrixEvaluator::swapSamples(sample_id u, sample_id v) {
+	bits->swapRows(u, v);
+	swap(x2[u], x2[v]);
+}
+
+// evaluators of every supported precision (storage precision, precision of sums)
+#ifndef SINGLE_PRECISION
+template class SparseMatrixEvaluator<fvalue, double>;
+template class InvertedIndexMatrixEvaluator<fvalue, double>;
+template class DenseMatrixEvaluator<fvalue, double>;
+template class HybridMatrixEvaluator<fvalue, double>;
+#endif
+template class SparseMatrixEvaluator<float, double>;
+template class InvertedIndexMatrixEvaluator<float, double>;
+template class DenseMatrixEvaluator<float, double>;
+template class HybridMatrixEvaluator<float, double>;
+template class SparseMatrixEvaluator<float, float>;
+template class InvertedIndexMatrixEvaluator<float, float>;
+template class DenseMatrixEvaluator<float, float>;
+template class HybridMatrixEvaluator<float, float>;
+
+// compressed encodings (sparse samples only)
+template class SparseMatrixEvaluator<Half, double>;
+template class InvertedIndexMatrixEvaluator<Half, double>;
+template class SparseMatrixEvaluator<BFloat16, double>;
+template class InvertedIndexMatrixEvaluator<BFloat16, double>;
+template class SparseMatrixEvaluator<int8_t, double>;
+template class InvertedIndexMatrixEvaluator<int8_t, double>;
@@ -20,13 +20,95 @@
 #define MATRIX_H_
 
 #include <algorithm>
+#include <type_traits>
 
 #include "numeric.h"
 #include "matrix_sparse.h"
+#include "matrix_dense.h"
 
+// rows announced to the matrix storage at once when streaming over samples
+#define PREFETCH_ROWS 1024
+
+// independent partial sums of dense dot products (rows are padded accordingly)
+#define DENSE_LANES 8
+
+// dense rows of at most this many values (with the padding) are evaluated by
+// loops of a fixed length (unrolled by the compiler)
+#define FIXED_STRIDE_LIMIT 64
+
+// sparse matrices at most this dense get an inverted index of their columns
+#define INVERTED_INDEX_DENSITY 0.01
+
+// cost of a posting list entry relative to a row entry (scattered accumulation)
+#define INVERTED_INDEX_COST 2
+
+/*
+ * Precision the values stored as S are processed in (compressed encodings are
+ * decoded to single precision).
+ */
+template<typename S>
+using Decoded = typename conditional<is_floating_point<S>::value, S, float>::type;
+
+/*
+ * Sparse values of the matrix in storage precision S (the working precision,
+ * single precision or a compressed encoding once the matrix is narrowed).
+ */
+template<typename S>
+inline S* sparseValues(sfmatrix* matrix) {
+	if constexpr (is_same<S, fvalue>::value) {
+		return matrix->values;
+	} else if constexpr (is_same<S, float>::value) {
+		return matrix->singles;
+	} else {
+		return (S*) matrix->codes;
+	}
+}
+
+/*
+ * Value of a feature stored as S.
+ */
+template<typename S>
+inline Decoded<S> sampleValue(sfmatrix* matrix, S value, feature_id feature) {
+	if constexpr (is_same<S, int8_t>::value) {
+		return decode(value) * matrix->scales[feature];
+	} else {
+		return decode(value);
+	}
+}
+
+/*
+ * Value of a feature put to the workspace. Quantized values are scaled twice,
+ * so that the stored values of the other samples can be multiplied by it
+ * without their scales.
+ */
+template<typename S>
+inline Decoded<S> workspaceValue(sfmatrix* matrix, S value, feature_id feature) {
+	if constexpr (is_same<S, int8_t>::value) {
+		return sampleValue(matrix, value, feature) * matrix->scales[feature];
+	} else {
+		return decode(value);
+	}
+}
+
+/*
+ * Dense row of the matrix in storage precision S.
+ */
+template<typename S>
+inline S* denseRow(dfmatrix* dense, sample_id v) {
+	if constexpr (is_same<S, fvalue>::value) {
+		return dense->row(v);
+	} else {
+		return dense->singleRow(v);
+	}
+}
+
+/*
+ * Dense copy of a sparse sample (zero outside of its features).
+ */
+template<typename S>
 class EvaluatorWorkspace {
 public:
-	fvalue* buffer;
+	S* buffer;
 
 	EvaluatorWorkspace(sfmatrix* matrix);
 	~EvaluatorWorkspace();
@@ -35,31 +117,198 @@ public:
 
 /*
  * Structure for holding the data (sparsely or densely) and other relevant information for kernel calculations.
+ * Evaluators are templates on the precision the samples are stored in (S) and
+ * the precision the dot products are summed in (A).
  */
 class MatrixEvaluator {
 
+protected:
 	sfmatrix* matrix; // this would house the samples
-	fvalue* x2; // ||x||^2 (this would be the squared 2-norm of a sample x)
-	EvaluatorWorkspace workspace;
+	fvalue* x2; // ||x||^2 (this would be the squared 2-norm of a sample x), owned by the matrix
 
-protected:
 	quantity getSize(sfmatrix* matrix);
 	quantity getDim(sfmatrix* matrix);
 
-	fvalue squaredNorm(sample_id v);
+	static fvalue squaredNorm(sfmatrix* matrix, sample_id v);
 
 public:
 	MatrixEvaluator(sfmatrix* matrix);
-	~MatrixEvaluator();
+	virtual ~MatrixEvaluator();
 
-	fvalue dot(sample_id u, sample_id v);
+	static MatrixEvaluator* create(sfmatrix* matrix);
+	static void computeNorms(sfmatrix* matrix);
 
-	void dist(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* buffer);
+	virtual fvalue dot(sample_id u, sample_id v) = 0;
+
+	virtual void dist(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* buffer) = 0;
 	void dist(sample_id id, sample_id rangeFrom, sample_id rangeTo, sample_id* mappings, fvector* buffer);
 	fvalue dist(sample_id u, sample_id v);
 
+	virtual void swapSamples(sample_id u, sample_id v) = 0;
+
+	// whether dist(u, v) equals dist(v, u) to the last bit (i.e. the sums do not
+	// follow the entries of the sample the others are compared to)
+	virtual bool isSymmetric() {
+		return false;
+	}
+
+	// evaluator of the same samples for another thread
+	virtual MatrixEvaluator* createWorker() {
+		return create(matrix);
+	}
+
+};
+
+/*
+ * Evaluator of samples stored in CSR format. The dot products of whole blocks
+ * of rows with the sample scattered to the workspace are computed by a kernel
+ * chosen for the processor (using vector gathers if available).
+ */
+template<typename S, typename A>
+class SparseMatrixEvaluator: public MatrixEvaluator {
+
+protected:
+	EvaluatorWorkspace<Decoded<S> > workspace;
+	quantity* lengths; // owned by the matrix
+	feature_id* rowIds; // decoded ids of the rows read (compressed indices only)
+	feature_id* sampleIds; // decoded ids of the sample the rows are compared to
+
+	void dots(sample_id rangeFrom, sample_id rangeTo, fvalue* buffer);
+
+public:
+	SparseMatrixEvaluator(sfmatrix* matrix);
+	~SparseMatrixEvaluator();
+
+	using MatrixEvaluator::dist;
+
+	fvalue dot(sample_id u, sample_id v);
+	void dist(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* buffer);
+	void swapSamples(sample_id u, sample_id v);
+
+	// the products of the shared features are summed in the order of the features
+	// (8-bit values are scaled twice in the workspace, so they differ)
+	bool isSymmetric() {
+		return !is_same<S, int8_t>::value;
+	}
+
+};
+
+/*
+ * Evaluator of very sparse samples (e.g. bag of words), which keeps an inverted
+ * index (CSC copy) of the matrix next to the CSR rows. The distances to a
+ * sample with few features are accumulated from the posting lists of its
+ * features only, so the work is proportional to the overlap of the samples.
+ * Each call chooses between the posting lists and the CSR rows by the amount
+ * of entries to be read. Posting lists refer to the samples by their original
+ * ids, which are mapped to the current positions.
+ */
+template<typename S, typename A>
+class InvertedIndexMatrixEvaluator: public SparseMatrixEvaluator<S, A> {
+
+	offset_id* postingOffsets; // width + 1 starts of the posting lists
+	sample_id* postingSamples;
+	S* postingValues;
+
+	sample_id* positions; // original id -> current position
+	sample_id* originals; // current position -> original id
+	offset_id entries;
+	bool shared; // the index belongs to another evaluator
+
+	void postingDists(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* buffer);
+
+public:
+	InvertedIndexMatrixEvaluator(sfmatrix* matrix);
+	InvertedIndexMatrixEvaluator(InvertedIndexMatrixEvaluator<S, A>* index);
+	~InvertedIndexMatrixEvaluator();
+
+	static bool isSuitable(sfmatrix* matrix);
+
+	using MatrixEvaluator::dist;
+
+	void dist(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* buffer);
+	void swapSamples(sample_id u, sample_id v);
+
+	// the posting lists are summed in the buffer, which has to hold the sums of the rows exactly
+	bool isSymmetric() {
+		return SparseMatrixEvaluator<S, A>::isSymmetric() && sizeof(A) <= sizeof(fvalue);
+	}
+
+	// workers read the index of this evaluator (the samples must not be swapped meanwhile)
+	MatrixEvaluator* createWorker() {
+		return new InvertedIndexMatrixEvaluator<S, A>(this);
+	}
+
+};
+
+/*
+ * Evaluator of densified samples. Rows are contiguous, so the dot products
+ * run over plain arrays and can be vectorized. Low dimensional data gets the
+ * row stride fixed at compile time (N, 0 if known at run time only).
+ */
+template<typename S, typename A, size_t N = 0>
+class DenseMatrixEvaluator: public MatrixEvaluator {
+
+	dfmatrix* dense;
+
+public:
+	DenseMatrixEvaluator(sfmatrix* matrix);
+
+	using MatrixEvaluator::dist;
+
+	fvalue dot(sample_id u, sample_id v);
+	void dist(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* buffer);
 	void swapSamples(sample_id u, sample_id v);
 
+	// the lanes are summed by the position of the features
+	bool isSymmetric() {
+		return true;
+	}
+
+};
+
+/*
+ * Evaluator of samples split into dense columns (frequently populated
+ * features) and the sparse rest, which stays in CSR format.
+ */
+template<typename S, typename A>
+class HybridMatrixEvaluator: public SparseMatrixEvaluator<S, A> {
+
+	dfmatrix* dense;
+
+public:
+	HybridMatrixEvaluator(sfmatrix* matrix);
+
+	using MatrixEvaluator::dist;
+
+	fvalue dot(sample_id u, sample_id v);
+	void dist(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* buffer);
+	void swapSamples(sample_id u, sample_id v);
+
+};
+
+/*
+ * Evaluator of binary samples stored as rows of bits. The dot product of two
+ * samples is the number of features they share (AND and population count),
+ * the squared norm of a sample is its number of features.
+ */
+class BinaryMatrixEvaluator: public MatrixEvaluator {
+
+	bmatrix* bits;
+
+public:
+	BinaryMatrixEvaluator(sfmatrix* matrix);
+
+	using MatrixEvaluator::dist;
+
+	fvalue dot(sample_id u, sample_id v);
+	void dist(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* buffer);
+	void swapSamples(sample_id u, sample_id v);
+
+	// the shared features are counted exactly
+	bool isSymmetric() {
+		return true;
+	}
+
 };
 
 /*
@@ -76,4 +325,23 @@ inline quantity MatrixEvaluator::getDim(sfmatrix* matrix) {
 	return (quantity) matrix->width;
 }
 
+/*
+ * Dot product of two padded rows (length has to be a multiple of DENSE_LANES).
+ * Keeping DENSE_LANES partial sums lets the compiler use vector instructions.
+ */
+template<typename S, typename A>
+inline __attribute__((always_inline)) A denseDot(const S* u, const S* v, size_t length) {
+	A sums[DENSE_LANES] = { 0.0 };
+	for (size_t i = 0; i < length; i += DENSE_LANES) {
+		for (size_t lane = 0; lane < DENSE_LANES; lane++) {
+			sums[lane] += (A) u[i + lane] * (A) v[i + lane];
+		}
+	}
+	A sum = 0.0;
+	for (size_t lane = 0; lane < DENSE_LANES; lane++) {
+		sum += sums[lane];
+	}
+	return sum;
+}
+
 #endif
@@ -0,0 +1,43 @@
+/**************************************************************************
+ * This file is part of osvm, a Support Vector Machine solver.
+ * Copyright (C) 2012 Gabriella Melki (melkiga@vcu.edu), Vojislav Kecman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+#include "matrix_bit.h"
+
+BitMatrix::BitMatrix(size_t height, size_t width) :
+		height(height),
+		width(width) {
+	stride = max((width + BIT_WORD_SIZE - 1) / BIT_WORD_SIZE, (size_t) 1);
+	words = new uint64_t[height * stride];
+	fill(words, words + height * stride, 0);
+}
+
+BitMatrix::~BitMatrix() {
+	delete [] words;
+}
+
+/*
+ * Number of features of sample v (its squared norm).
+ */
+quantity BitMatrix::count(sample_id v) {
+	uint64_t *bits = row(v);
+	quantity total = 0;
+	for (size_t i = 0; i < stride; i++) {
+		total += (quantity) __builtin_popcountll(bits[i]);
+	}
+	return total;
+}
@@ -0,0 +1,68 @@
+/**************************************************************************
+ * This file is part of osvm, a Support Vector Machine solver.
+ * Copyright (C) 2012 Gabriella Melki (melkiga@vcu.edu), Vojislav Kecman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+#ifndef BIT_H_
+#define BIT_H_
+
+#include <algorithm>
+#include <cstdint>
+
+#include "numeric.h"
+
+// bits in a word of a bit row
+#define BIT_WORD_SIZE 64
+
+/// <summary>BitMatrix Class (samples whose values are all ones)
+/// <param name = "words">rows of bits, bit f of a row is set if the sample has feature f</param>
+/// <param name = "stride">number of words of every row</param>
+/// <param name = "height">...</param>
+/// <param name = "width">...</param></summary>
+struct BitMatrix {
+
+	uint64_t *words;
+	size_t stride;
+
+	size_t height;
+	size_t width;
+
+	BitMatrix(size_t height, size_t width);
+	~BitMatrix();
+
+	uint64_t* row(sample_id v);
+	void set(sample_id v, feature_id feature);
+	quantity count(sample_id v);
+	void swapRows(sample_id u, sample_id v);
+
+};
+
+inline uint64_t* BitMatrix::row(sample_id v) {
+	return words + v * stride;
+}
+
+inline void BitMatrix::set(sample_id v, feature_id feature) {
+	row(v)[feature / BIT_WORD_SIZE] |= (uint64_t) 1 << (feature % BIT_WORD_SIZE);
+}
+
+inline void BitMatrix::swapRows(sample_id u, sample_id v) {
+	swap_ranges(row(u), row(u) + stride, row(v));
+}
+
+/// Alias for BitMatrix
+typedef BitMatrix bmatrix;
+
+#endif
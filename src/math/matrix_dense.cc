@@ -18,21 +18,59 @@
 
 #include "matrix_dense.h"
 
-DenseMatrix::DenseMatrix(fmatrix *matrix) :
-		matrix(matrix) {
-	forwardMap = new sample_id[matrix->size1];
-	reverseMap = new sample_id[matrix->size1];
-	for (sample_id i = 0; i < matrix->size1; i++) {
-		forwardMap[i] = i;
-		reverseMap[i] = i;
+#include <cstdlib>
+#include <new>
+
+DenseMatrix::DenseMatrix(size_t height, size_t width) :
+		singles(NULL),
+		height(height),
+		width(width) {
+	size_t lane = DENSE_ALIGNMENT / sizeof(fvalue);
+	stride = (width + lane - 1) / lane * lane;
+	size_t size = max(height * stride * sizeof(fvalue), (size_t) DENSE_ALIGNMENT);
+#ifdef _WIN32
+	values = (fvalue*) _aligned_malloc(size, DENSE_ALIGNMENT);
+#else
+	values = (fvalue*) aligned_alloc(DENSE_ALIGNMENT, size);
+#endif
+	if (values == NULL) {
+		throw bad_alloc();
 	}
-	orderRange = matrix->size1;
-	height = matrix->size1;
-	width = matrix->size2;
+	fill(values, values + height * stride, 0.0);
 }
 
 DenseMatrix::~DenseMatrix() {
-	fmatrix_free(matrix);
-	delete [] forwardMap;
-	delete [] reverseMap;
+#ifdef _WIN32
+	_aligned_free(values);
+	_aligned_free(singles);
+#else
+	free(values);
+	free(singles);
+#endif
+}
+
+/*
+ * Replaces the values with their single precision copies (keeping the stride).
+ */
+void DenseMatrix::narrow() {
+	if (singles || sizeof(fvalue) == sizeof(float)) {
+		return;
+	}
+	size_t size = max(height * stride * sizeof(float), (size_t) DENSE_ALIGNMENT);
+	size = (size + DENSE_ALIGNMENT - 1) / DENSE_ALIGNMENT * DENSE_ALIGNMENT;
+#ifdef _WIN32
+	singles = (float*) _aligned_malloc(size, DENSE_ALIGNMENT);
+#else
+	singles = (float*) aligned_alloc(DENSE_ALIGNMENT, size);
+#endif
+	if (singles == NULL) {
+		throw bad_alloc();
+	}
+	copy(values, values + height * stride, singles);
+#ifdef _WIN32
+	_aligned_free(values);
+#else
+	free(values);
+#endif
+	values = NULL;
 }
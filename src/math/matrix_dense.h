@@ -19,30 +19,55 @@
 #ifndef DENSE_H_
 #define DENSE_H_
 
+#include <algorithm>
+
 #include "numeric.h"
 
+// alignment of the rows (in bytes)
+#define DENSE_ALIGNMENT 64
+
 /// <summary>DenseMatrix Class
-/// <param name = "matrix">...</param>
-/// <param name = "forwardMap">...</param>
-/// <param name = "orderRange">...</param>
+/// <param name = "values">row-major values, rows padded with zeros to 'stride'</param>
+/// <param name = "singles">the values rounded to single precision (NULL unless the matrix
+/// was narrowed, 'values' is NULL then)</param>
+/// <param name = "stride">distance between consecutive rows (multiple of DENSE_ALIGNMENT bytes)</param>
 /// <param name = "height">...</param>
 /// <param name = "width">...</param></summary>
 struct DenseMatrix {
 
-	fmatrix *matrix;
-
-	sample_id *forwardMap;
-	sample_id *reverseMap;
-	sample_id orderRange;
+	fvalue *values;
+	float *singles;
+	size_t stride;
 
 	size_t height;
 	size_t width;
 
-	DenseMatrix(fmatrix *matrix);
+	DenseMatrix(size_t height, size_t width);
 	~DenseMatrix();
 
+	fvalue* row(sample_id v);
+	float* singleRow(sample_id v);
+	void swapRows(sample_id u, sample_id v);
+	void narrow();
+
 };
 
+inline fvalue* DenseMatrix::row(sample_id v) {
+	return values + v * stride;
+}
+
+inline float* DenseMatrix::singleRow(sample_id v) {
+	return singles + v * stride;
+}
+
+inline void DenseMatrix::swapRows(sample_id u, sample_id v) {
+	if (singles) {
+		swap_ranges(singleRow(u), singleRow(u) + stride, singleRow(v));
+	} else {
+		swap_ranges(row(u), row(u) + stride, row(v));
+	}
+}
+
 /// Alias for DenseMatrix
 typedef DenseMatrix dfmatrix;
 
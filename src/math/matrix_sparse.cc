@@ -18,17 +18,302 @@
 
 #include "matrix_sparse.h"
 
-SparseMatrix::SparseMatrix(fvalue *values, feature_id *features, id *offsets,
-		size_t size1, size_t size2) :
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+/*
+ * Size of a compressed value.
+ */
+static size_t codeSize(Precision precision) {
+	switch (precision) {
+	case HALF_PRECISION:
+		return sizeof(Half);
+	case BFLOAT16_PRECISION:
+		return sizeof(BFloat16);
+	default:
+		return sizeof(int8_t);
+	}
+}
+
+void* allocateEntries(size_t count, size_t size) {
+	size_t bytes = max(count * size, (size_t) SPARSE_ARRAY_ALIGNMENT);
+	bytes = (bytes + SPARSE_ARRAY_ALIGNMENT - 1) / SPARSE_ARRAY_ALIGNMENT * SPARSE_ARRAY_ALIGNMENT;
+#ifdef _WIN32
+	void *entries = _aligned_malloc(bytes, SPARSE_ARRAY_ALIGNMENT);
+#else
+	void *entries = aligned_alloc(SPARSE_ARRAY_ALIGNMENT, bytes);
+#endif
+	if (entries == NULL) {
+		throw bad_alloc();
+	}
+	return entries;
+}
+
+void freeEntries(void *entries) {
+#ifdef _WIN32
+	_aligned_free(entries);
+#else
+	free(entries);
+#endif
+}
+
+SparseMatrix::SparseMatrix(fvalue *values, feature_id *features, offset_id *offsets,
+		quantity *lengths, size_t size1, size_t size2) :
 		values(values),
+		singles(NULL),
+		codes(NULL),
+		scales(NULL),
 		features(features),
+		indices(NULL),
+		indexOffsets(NULL),
 		offsets(offsets),
+		lengths(lengths),
+		norms(NULL),
 		height(size1),
-		width(size2) {
+		width(size2),
+		storage(NULL),
+		precision(DOUBLE_PRECISION),
+		precisionError(0.0),
+		dense(NULL),
+		bits(NULL),
+		relayouts(0) {
 }
 
 SparseMatrix::~SparseMatrix() {
-	delete [] values;
-	delete [] features;
-	delete [] offsets;
+	delete dense;
+	delete bits;
+	freeEntries(singles);
+	freeEntries(codes);
+	delete [] scales;
+	delete [] indices;
+	delete [] indexOffsets;
+	if (storage) {
+		delete storage;
+	} else {
+		freeEntries(values);
+		freeEntries(features);
+		delete [] offsets;
+		delete [] lengths;
+		delete [] norms;
+	}
+}
+
+/*
+ * Samples are reordered by swapping their offsets, so after a while reading
+ * the rows in order jumps all over the entry arrays. The rows are copied to
+ * new arrays in their current order (dropping any gaps) once too many of them
+ * are scattered. Arrays owned by a storage are left in place.
+ */
+bool SparseMatrix::relayout() {
+	if (offsets == NULL || storage != NULL) {
+		return false;
+	}
+	quantity scattered = 0;
+	offset_id entries = height > 0 ? padRow(lengths[0]) : 0;
+	for (size_t row = 1; row < height; row++) {
+		if (offsets[row] != offsets[row - 1] + padRow(lengths[row - 1])) {
+			scattered++;
+		}
+		entries += padRow(lengths[row]);
+	}
+	if (scattered <= RELAYOUT_SCATTER_RATIO * height) {
+		return false;
+	}
+
+	relayoutTimer.start();
+	fvalue *vals = values ? (fvalue*) allocateEntries(entries, sizeof(fvalue)) : NULL;
+	float *sings = singles ? (float*) allocateEntries(entries, sizeof(float)) : NULL;
+	char *cods = codes ? (char*) allocateEntries(entries, codeSize(precision)) : NULL;
+	feature_id *feats = features ? (feature_id*) allocateEntries(entries, sizeof(feature_id)) : NULL;
+	uint8_t *inds = NULL;
+	if (indices) {
+		offset_id bytes = 0;
+		for (size_t row = 0; row < height; row++) {
+			bytes += countIndexBytes(row);
+		}
+		inds = new uint8_t[bytes];
+	}
+	offset_id target = 0;
+	offset_id indexTarget = 0;
+	for (size_t row = 0; row < height; row++) {
+		offset_id length = padRow(lengths[row]);
+		if (vals) {
+			memcpy(vals + target, values + offsets[row], length * sizeof(fvalue));
+		}
+		if (sings) {
+			memcpy(sings + target, singles + offsets[row], length * sizeof(float));
+		}
+		if (cods) {
+			size_t size = codeSize(precision);
+			memcpy(cods + target * size, (char*) codes + offsets[row] * size, length * size);
+		}
+		if (feats) {
+			memcpy(feats + target, features + offsets[row], length * sizeof(feature_id));
+		}
+		if (inds) {
+			offset_id bytes = countIndexBytes(row);
+			memcpy(inds + indexTarget, indices + indexOffsets[row], bytes);
+			indexOffsets[row] = indexTarget;
+			indexTarget += bytes;
+		}
+		offsets[row] = target;
+		target += length;
+	}
+	freeEntries(values);
+	freeEntries(singles);
+	freeEntries(codes);
+	freeEntries(features);
+	delete [] indices;
+	values = vals;
+	singles = sings;
+	codes = cods;
+	features = feats;
+	indices = inds;
+	relayoutTimer.stop();
+	relayouts++;
+	return true;
+}
+
+/*
+ * Number of entries spanned by the rows.
+ */
+offset_id SparseMatrix::countEntries() {
+	offset_id entries = 0;
+	for (size_t row = 0; row < height; row++) {
+		entries = max(entries, offsets[row] + padRow(lengths[row]));
+	}
+	return entries;
+}
+
+/*
+ * Encodes the values of all rows (padding included). The norms, if already
+ * known, are recomputed from the encoded values, so that every sample stays
+ * at distance 0 from itself.
+ */
+template<typename C, typename E>
+C* SparseMatrix::encode(offset_id entries, E encoder) {
+	C *encoded = (C*) allocateEntries(entries, sizeof(C));
+	for (size_t row = 0; row < height; row++) {
+		fvalue sum = 0.0;
+		offset_id end = offsets[row] + padRow(lengths[row]);
+		for (offset_id entry = offsets[row]; entry < end; entry++) {
+			encoded[entry] = encoder(values[entry], features[entry]);
+			fvalue value = decode(encoded[entry]);
+			if (scales) {
+				value *= scales[features[entry]];
+			}
+			precisionError = max(precisionError, (fvalue) fabs(value - values[entry]));
+			sum += pow2(value);
+		}
+		if (norms) {
+			norms[row] = sum;
+		}
+	}
+	return encoded;
+}
+
+/*
+ * Switches the samples to the given precision. Below double precision the
+ * values are replaced by their single precision copies, halving the memory
+ * read by the kernels. The compressed encodings (a quarter to an eighth of
+ * the memory) are used for purely sparse samples, the dense columns of other
+ * matrices are kept in single precision (with double precision sums) instead.
+ * Samples kept out of core stay in the file, so they keep double precision.
+ * Binary samples are exact already.
+ */
+void SparseMatrix::narrow(Precision precision) {
+	if (precision == DOUBLE_PRECISION || bits || (storage && !storage->isResident())) {
+		return;
+	}
+	if (precision >= HALF_PRECISION && (dense || values == NULL)) {
+		precision = MIXED_PRECISION;
+	}
+
+	offset_id entries = values ? countEntries() : 0;
+	if (precision == HALF_PRECISION) {
+		codes = encode<Half>(entries, [](fvalue value, feature_id) {
+			return encodeHalf((float) value);
+		});
+	} else if (precision == BFLOAT16_PRECISION) {
+		codes = encode<BFloat16>(entries, [](fvalue value, feature_id) {
+			return encodeBFloat16((float) value);
+		});
+	} else if (precision == INT8_PRECISION) {
+		// the largest magnitude of every feature maps to QUANTIZED_MAX
+		scales = new float[width];
+		fill(scales, scales + width, 0.0f);
+		for (size_t row = 0; row < height; row++) {
+			for (offset_id entry = offsets[row]; entry < offsets[row] + lengths[row]; entry++) {
+				scales[features[entry]] = max(scales[features[entry]], (float) fabs(values[entry]));
+			}
+		}
+		for (size_t feature = 0; feature < width; feature++) {
+			scales[feature] /= QUANTIZED_MAX;
+		}
+		float *featureScales = scales;
+		codes = encode<int8_t>(entries, [featureScales](fvalue value, feature_id feature) {
+			return quantize((float) value, featureScales[feature]);
+		});
+	} else if (values && sizeof(fvalue) != sizeof(float)) {
+		singles = encode<float>(entries, [](fvalue value, feature_id) {
+			return (float) value;
+		});
+	}
+	if (codes || singles) {
+		if (storage == NULL) {
+			freeEntries(values);
+		}
+		values = NULL;
+	}
+	if (dense) {
+		dense->narrow();
+	}
+	this->precision = precision;
+}
+
+/*
+ * Replaces the feature ids with the gaps between them (see encodeDeltas),
+ * which mostly take a single byte. The evaluators decode the ids of every
+ * row as it is read. Samples kept out of core are left in place.
+ */
+void SparseMatrix::compressIndices() {
+	if (features == NULL || indices || (storage && !storage->isResident())) {
+		return;
+	}
+	offset_id bytes = 0;
+	for (size_t row = 0; row < height; row++) {
+		feature_id *ids = features + offsets[row];
+		bytes += deltaBytes(deltaWidth(ids, lengths[row]), lengths[row]);
+	}
+	indices = new uint8_t[bytes];
+	indexOffsets = new offset_id[height];
+	uint8_t *end = indices;
+	for (size_t row = 0; row < height; row++) {
+		indexOffsets[row] = end - indices;
+		end = encodeDeltas(features + offsets[row], lengths[row], end);
+	}
+	if (storage == NULL) {
+		freeEntries(features);
+	}
+	features = NULL;
+}
+
+/*
+ * Number of bytes of the compressed indices of a row.
+ */
+offset_id SparseMatrix::countIndexBytes(size_t row) {
+	return deltaBytes(indices[indexOffsets[row]], lengths[row]);
+}
+
+/*
+ * Length of the longest row.
+ */
+quantity SparseMatrix::getMaxLength() {
+	quantity length = 0;
+	for (size_t row = 0; offsets && row < height; row++) {
+		length = max(length, lengths[row]);
+	}
+	return length;
 }
@@ -20,27 +20,160 @@
 #define SPARSE_H_
 
 #include "numeric.h"
+#include "matrix_dense.h"
+#include "matrix_bit.h"
+#include "encoding.h"
+#include "../time/timer.h"
+
+// rows start at multiples of this many entries and are padded with zeros up to
+// the next one (vector kernels read whole padded rows). Values and ids share
+// the offsets, so rows are aligned in entries, not in bytes: a row start is
+// 32-byte aligned for double values but only 16-byte for single precision
+// values and ids and 4-byte for 8-bit values. Byte alignment of every array
+// would pad rows to up to 64 entries, and the kernels use unaligned loads.
+#define SPARSE_ROW_ALIGNMENT 4
+
+// alignment of the entry arrays (in bytes)
+#define SPARSE_ARRAY_ALIGNMENT 64
+
+// rows are laid out again once more than this fraction of them does not
+// directly follow the previous one
+#define RELAYOUT_SCATTER_RATIO 0.1
+
+/// <summary>Number of entries occupied by a row of the given length.</summary>
+inline offset_id padRow(offset_id length) {
+	return (length + SPARSE_ROW_ALIGNMENT - 1) / SPARSE_ROW_ALIGNMENT * SPARSE_ROW_ALIGNMENT;
+}
+
+/// <summary>Precision of the stored samples and of the sums in the kernels: double
+/// storage and sums, single precision storage with double sums, or single precision
+/// storage and sums. The compressed encodings (half precision, bfloat16 and 8-bit values
+/// scaled per feature) are decoded to single precision and summed in double precision.
+/// Distances are combined in the working precision (fvalue).</summary>
+enum Precision {
+	DOUBLE_PRECISION,
+	MIXED_PRECISION,
+	FLOAT_PRECISION,
+	HALF_PRECISION,
+	BFLOAT16_PRECISION,
+	INT8_PRECISION
+};
+
+/// <summary>Encoding of the feature ids: plain or the gaps between them packed to
+/// the fewest bytes (see encodeDeltas).</summary>
+enum IndexEncoding {
+	PLAIN_INDICES,
+	DELTA_INDICES
+};
+
+/// <summary>Allocates an aligned array of values or feature ids.</summary>
+void* allocateEntries(size_t count, size_t size);
+
+/// <summary>Releases an array obtained from allocateEntries (NULL is ignored).</summary>
+void freeEntries(void *entries);
+
+/// <summary>Memory region owning the matrix arrays when they were not allocated
+/// by the matrix itself (e.g. a memory mapped file).</summary>
+class MatrixStorage {
+
+public:
+	virtual ~MatrixStorage() {}
+
+	/// <summary>Called before rows [from, to) are read one after another.</summary>
+	virtual void prefetch(size_t, size_t) {}
+
+	/// <summary>Tells whether all the arrays are kept in memory.</summary>
+	virtual bool isResident() {
+		return true;
+	}
+
+};
 
 /// <summary>Sparse Matrix Class
 /// <param name = "values">...</param>
+/// <param name = "singles">the values rounded to single precision (NULL unless the matrix
+/// was narrowed, 'values' is NULL then)</param>
+/// <param name = "codes">the values in a compressed encoding (Half, BFloat16 or int8_t, NULL
+/// unless the matrix was narrowed to it, 'values' is NULL then)</param>
+/// <param name = "scales">scales of the quantized values of every feature (NULL unless the
+/// values are quantized)</param>
 /// <param name = "features">...</param>
-/// <param name = "offsets">...</param>
+/// <param name = "indices">the feature ids compressed with encodeDeltas (NULL unless the
+/// indices were compressed, 'features' is NULL then)</param>
+/// <param name = "indexOffsets">start of every row in 'indices' (in bytes)</param>
+/// <param name = "offsets">start of every row (a multiple of SPARSE_ROW_ALIGNMENT)</param>
+/// <param name = "lengths">number of entries of every row (without the padding)</param>
+/// <param name = "norms">squared norms of the rows (NULL until computed)</param>
 /// <param name = "height">...</param>
-/// <param name = "width">...</param></summary>
+/// <param name = "width">...</param>
+/// <param name = "storage">owner of the arrays (NULL if allocated with allocateEntries and new[])</param>
+/// <param name = "precision">precision the samples are stored and evaluated in</param>
+/// <param name = "precisionError">largest difference between a value and its narrowed copy</param>
+/// <param name = "dense">row-major copy of the samples or of their frequently populated columns
+/// (NULL unless the matrix was split, the sparse arrays hold the remaining entries then and are
+/// NULL when no entries remain)</param>
+/// <param name = "bits">bit rows of binary samples (NULL unless the matrix was binarized, the
+/// sparse arrays are NULL then)</param>
+/// <param name = "relayouts">number of times the rows were laid out in their current order</param>
+/// <param name = "relayoutTimer">total time spent laying out the rows</param></summary>
 struct SparseMatrix {
 
 	fvalue *values;
+	float *singles;
+	void *codes;
+	float *scales;
 	feature_id *features;
+	uint8_t *indices;
+	offset_id *indexOffsets;
 
-	id *offsets;
+	offset_id *offsets;
+	quantity *lengths;
+	fvalue *norms;
 	size_t height;
 	size_t width;
 
-	SparseMatrix(fvalue *values, feature_id *features, id *offsets, size_t size1, size_t size2);
+	MatrixStorage *storage;
+	Precision precision;
+	fvalue precisionError;
+	DenseMatrix *dense;
+	BitMatrix *bits;
+
+	quantity relayouts;
+	Timer relayoutTimer;
+
+	SparseMatrix(fvalue *values, feature_id *features, offset_id *offsets, quantity *lengths,
+			size_t size1, size_t size2);
 	~SparseMatrix();
 
+	bool relayout();
+	void narrow(Precision precision);
+	void compressIndices();
+
+	feature_id* rowFeatures(size_t row, feature_id *buffer);
+	quantity getMaxLength();
+
+private:
+	offset_id countEntries();
+	offset_id countIndexBytes(size_t row);
+	template<typename C, typename E>
+	C* encode(offset_id entries, E encoder);
+
 };
 
+/// <summary>Feature ids of a row padded like the row: either a pointer to 'features',
+/// or 'buffer' (of at least padRow(getMaxLength()) ids) filled with the decoded indices.</summary>
+inline feature_id* SparseMatrix::rowFeatures(size_t row, feature_id *buffer) {
+	if (indices == NULL) {
+		return features + offsets[row];
+	}
+	quantity length = lengths[row];
+	decodeDeltas(indices + indexOffsets[row], length, buffer);
+	for (offset_id i = length; i < padRow(length); i++) {
+		buffer[i] = 0;
+	}
+	return buffer;
+}
+
 /// Alias for SparseMatrix
 typedef SparseMatrix sfmatrix;
 
@@ -23,6 +23,9 @@
 //#define SINGLE_PRECISION
 // comment out to disable debug mode
 #define DEBUG_MODE
+// comment out to use 32-bit offsets of the sparse entries (halves their size,
+// but limits the data to 2^32 stored entries including the padding of the rows)
+#define LARGE_DATA
 
 #ifndef DEBUG_MODE
 // turning off range check for gsl when production mode enabled
@@ -214,14 +217,19 @@ typedef gsl_vector_ushort_view lvectorv;
 typedef unsigned int id;
 typedef id sample_id;
 typedef unsigned short short_id;
-typedef short_id feature_id;
+typedef unsigned int feature_id;
 typedef short_id label_id;
 typedef unsigned int quantity;    // NOTE: This should be 'size_t'
+#ifdef LARGE_DATA
+typedef unsigned long long offset_id;
+#else
+typedef unsigned int offset_id;
+#endif
 
 #define INVALID_ID ((id) -1)
 #define INVALID_SAMPLE_ID INVALID_ID
 #define INVALID_SHORT_ID ((short_id) -1)
-#define INVALID_FEATURE_ID INVALID_SHORT_ID
+#define INVALID_FEATURE_ID ((feature_id) -1)
 #define INVALID_LABEL_ID INVALID_SHORT_ID
 
 #define rng_setup gsl_rng_env_setup
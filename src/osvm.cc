@@ -62,6 +62,15 @@ int main(int argc, char *argv[]) {
 		(PR_CACHE_SIZE, bopt::value<int>()->default_value(DEFAULT_CACHE_SIZE), "cache size (in MB)")
 		(PR_EPOCH, bopt::value<fvalue>()->default_value(0.5), "epochs number")
 		(PR_MARGIN, bopt::value<fvalue>()->default_value(0.1), "margin")
+		(PR_THREADS, bopt::value<int>()->default_value(DEFAULT_READ_THREADS), "threads reading the input and computing the kernel matrix (0 for all cores)")
+		(PR_WRITE_BINARY, bopt::value<string>(), "save preprocessed data to binary file")
+		(PR_READ_BINARY, bopt::value<string>(), "load preprocessed data from binary file")
+		(PR_RESIDENT_MEMORY, bopt::value<int>()->default_value(DEFAULT_RESIDENT_MEMORY), "resident memory for preprocessed samples in MB (0 for no limit)")
+		(PR_MATRIX_TYPE, bopt::value<string>()->default_value(MATRIX_TYPE_AUTO), "sample storage (auto, sparse, dense, hybrid, binary)")
+		(PR_HASH_BITS, bopt::value<int>()->default_value(DEFAULT_HASH_BITS), "hash feature ids into 2^N columns (0 for no hashing)")
+		(PR_PRECISION, bopt::value<string>()->default_value(PRECISION_DOUBLE), "sample precision (double, mixed, float, half, bfloat16, int8)")
+		(PR_INDEX_ENCODING, bopt::value<string>()->default_value(INDEX_ENCODING_PLAIN), "feature id encoding (plain, delta)")
+		(PR_EXP_ACCURACY, bopt::value<string>()->default_value(EXP_ACCURACY_EXACT), "accuracy of the kernel exp (exact, precise, fast)")
 		(PR_INPUT, bopt::value<string>(), "input file");
 
 	bopt::positional_options_description opt;
@@ -1,20 +1,25 @@
 #include "cache.h"
 
-CachedKernelEvaluator::CachedKernelEvaluator(RbfKernelEvaluator *evaluator, SolverStrategy *strategy, quantity probSize, quantity cchSize, SwapListener *listener) :
+CachedKernelEvaluator::CachedKernelEvaluator(RbfKernelEvaluator *evaluator, SolverStrategy *strategy, quantity probSize, quantity cchSize, quantity threads, SwapListener *listener) :
+		kernelRows(NULL),
+		gammaVersion(1),
+		lookups(0),
+		hits(0),
+		filled(0),
+		computed(0),
 		evaluator(evaluator),
 		strategy(strategy),
 		listener(listener) {
 	problemSize = probSize;
 	currentSize = problemSize;
-	quantity fvaluePerMb = 1024 * 1024 / sizeof(fvalue);
-	cacheSize = max(cchSize * fvaluePerMb, 2 * probSize);
+	cacheSize = getCacheSize(probSize, cchSize);
+	// the distances and the kernel values of all the pairs are kept when both fit
+	bool precomputed = cacheSize / probSize >= (size_t) 2 * probSize;
 	if (cacheSize / probSize > probSize) {
-		cacheSize = probSize * probSize;
+		cacheSize = (size_t) probSize * probSize;
 	}
-	CacheDimension dim = findCacheDimension(cacheSize, problemSize);
-	cacheDepth = dim.depth;
-	cacheLines = dim.lines;
-	cache = new fvalue[cacheSize];
+	cacheLines = (quantity) (cacheSize / probSize);
+	cache = new fvalue[(size_t) cacheLines * probSize];
 
 	// initialize alphas and output vector
 	svnumber = 1;
@@ -24,6 +29,7 @@ CachedKernelEvaluator::CachedKernelEvaluator(RbfKernelEvaluator *evaluator, Solv
 	outputView = fvectorv_array(output.data(), problemSize);
 
 	kernelVector = fvector_alloc(problemSize);
+	symmetric = evaluator->isSymmetric();
 
 	fbuffer = fvector_alloc(problemSize);
 	fbufferView = fvector_subv(fbuffer, 0, svnumber);
@@ -36,17 +42,34 @@ CachedKernelEvaluator::CachedKernelEvaluator(RbfKernelEvaluator *evaluator, Solv
 	}
 
 	// initialize cache entries
-	views = new fvectorv[cacheLines]; // NOTE: views is a vector of vectors (holds the kernel), cacheLines here is problemSize
+	views = new fvectorv[cacheLines]; // NOTE: views is a vector of vectors (holds the kernel rows)
 	mappings = new EntryMapping[problemSize];
 	entries = new CacheEntry[cacheLines];
+	for (entry_id i = 0; i < cacheLines; i++) {
+		views[i] = fvectorv_array(cache + (size_t) i * problemSize, problemSize);
+	}
 
+	clearRows();
+	if (precomputed) {
+		precomputeRows(threads);
+	}
 	initialize();
 }
 
+/*
+ * Number of values that fit in 'cchSize' MB, at least two rows. The product is
+ * computed in size_t, so caches of 4G values and more do not overflow.
+ */
+size_t CachedKernelEvaluator::getCacheSize(quantity probSize, quantity cchSize) {
+	size_t fvaluePerMb = 1024 * 1024 / sizeof(fvalue);
+	return max(cchSize * fvaluePerMb, (size_t) 2 * probSize);
+}
+
 CachedKernelEvaluator::~CachedKernelEvaluator() {
 	delete evaluator;
 	delete listener;
 	delete [] cache;
+	delete [] kernelRows;
 	delete [] views;
 	delete [] mappings;
 	delete [] entries;
@@ -58,56 +81,120 @@ fvalue CachedKernelEvaluator::checkViolation(sample_id v) {
 	return output[v]*getLabel(v);
 }
 
-void CachedKernelEvaluator::resizeCache() {
-	quantity newCacheDepth = min((quantity) (CACHE_DEPTH_INCREASE * cacheDepth), problemSize);
-	quantity newCacheLines = min(cacheSize / newCacheDepth, problemSize);
-	fvalue *newCache = new fvalue[cacheSize];
-
-	CacheEntry &lastInvalid = entries[lruEntry];
-
-	entry_id entry = lastInvalid.prev;
-	for (quantity i = 0; i < newCacheLines; i++) {
-		CacheEntry& current = entries[entry];
-
-		fvectorv oldView = views[current.vector];
-		size_t oldSize = oldView.vector.size;
-		fvectorv newView;
-		if (oldSize > 0) {
-			newView = fvectorv_array(newCache + i * newCacheDepth, oldView.vector.size);
-			fvector_cpy(&newView.vector, &oldView.vector);
-		} else {
-			newView = fvectorv_array(newCache + i * newCacheDepth, 1);
-			newView.vector.size = 0;
+/*
+ * Returns the kernel row of sample 'v' for the samples currently trained on
+ * (from svnumber to currentSize, in their current order). Cached rows hold
+ * the squared distances to all the samples in their original order, so they
+ * serve every following training, whatever its C and gamma: only the exp is
+ * evaluated again. Once the cache is full, the row of a new violator takes
+ * the line used least since the last trainings (see findEvictedEntry), when
+ * there is one. Otherwise it is evaluated for the current training only.
+ *
+ * With the whole distance matrix precomputed, the kernel values of every row are
+ * evaluated once for each gamma.
+ */
+fvalue* CachedKernelEvaluator::getKernelRow(sample_id v) {
+	lookups++;
+	fvalue *kernels = kernelVector->data;
+	sample_id original = backwardOrder[v];
+	if (kernelRows != NULL) {
+		hits++;
+		fvalue *row = kernelRows + (size_t) original * problemSize;
+		if (kernelVersions[original] != gammaVersion) {
+			memcpy(row, views[original].vector.data, problemSize * sizeof(fvalue));
+			evaluator->applyKernel(row, problemSize);
+			kernelVersions[original] = gammaVersion;
+		}
+		for (sample_id i = svnumber; i < currentSize; i++) {
+			kernels[i] = row[backwardOrder[i]];
 		}
-		views[current.vector] = newView;
-		entry = current.prev;
+		return kernels;
 	}
 
-	if (newCacheLines < cacheLines) {
-		CacheEntry &firstInvalid = entries[entry];
-		CacheEntry &lastValid = entries[firstInvalid.next];
-
-		for (quantity i = newCacheLines; i < cacheLines; i++) {
-			CacheEntry& current = entries[entry];
-
-			EntryMapping &mapping = mappings[current.mapping];
-			mapping.cacheEntry = INVALID_ENTRY_ID;
-
-			entry = current.prev;
+	entry_id entry = mappings[original].cacheEntry;
+	if (entry != INVALID_ENTRY_ID) {
+		hits++;
+		entries[entry].uses++;
+		fvalue *row = views[entry].vector.data;
+		for (sample_id i = svnumber; i < currentSize; i++) {
+			kernels[i] = row[backwardOrder[i]];
 		}
+		evaluator->applyKernel(kernels + svnumber, currentSize - svnumber);
+		return kernels;
+	}
 
-		CacheEntry &firstValid = entries[lastInvalid.prev];
+	entry = findEvictedEntry();
+	if (entry == INVALID_ENTRY_ID) {
+		evalDistances(v, svnumber, currentSize);
+		evaluator->applyKernel(kernels + svnumber, currentSize - svnumber);
+		return kernels;
+	}
 
-		lastValid.prev = lastInvalid.prev;
-		firstValid.next = firstInvalid.next;
-		lruEntry = firstInvalid.next;
+	sample_id evicted = entries[entry].mapping;
+	if (evicted != INVALID_SAMPLE_ID) {
+		mappings[evicted].cacheEntry = INVALID_ENTRY_ID;
+		cachedRows[forwardOrder[evicted]] = 0;
+	}
+	entries[entry].mapping = original;
+	entries[entry].uses = 1;
+	evalDistances(v, 0, problemSize);
+	mappings[original].cacheEntry = entry;
+	cachedRows[v] = 1;
+	fvalue *row = views[entry].vector.data;
+	for (sample_id i = 0; i < problemSize; i++) {
+		row[backwardOrder[i]] = kernels[i];
+	}
+	evaluator->applyKernel(kernels + svnumber, currentSize - svnumber);
+	return kernels;
+}
 
-		cacheLines = newCacheLines;
+/*
+ * Evaluates the squared distances of sample 'v' to the samples in range 'from'
+ * to 'to'. If the evaluator gives symmetric distances to the last bit, the ones
+ * to the samples with cached rows are copied from their rows (the rows stay the
+ * same as evaluated on their own). Each of them is read from another row and
+ * every evaluation has a fixed cost, so the distances are copied only when a
+ * large part of the range is cached and for runs of at least SYMMETRIC_FILL_RUN
+ * samples.
+ */
+void CachedKernelEvaluator::evalDistances(sample_id v, sample_id from, sample_id to) {
+	quantity cached = symmetric ? (quantity) count(cachedRows.begin() + from, cachedRows.begin() + to, 1) : 0;
+	if (cached == 0 || cached * SYMMETRIC_FILL_RATIO < to - from) {
+		evaluator->evalDist(v, from, to, kernelVector);
+		computed += to - from;
+		return;
 	}
 
-	delete [] cache;
-	cache = newCache;
-	cacheDepth = newCacheDepth;
+	fvalue *kernels = kernelVector->data;
+	sample_id original = backwardOrder[v];
+	sample_id evalFrom = from;
+	quantity copied = 0;
+	sample_id i = from;
+	while (i < to) {
+		if (!cachedRows[i]) {
+			i++;
+			continue;
+		}
+		sample_id cachedFrom = i;
+		while (i < to && cachedRows[i]) {
+			i++;
+		}
+		if (i - cachedFrom >= SYMMETRIC_FILL_RUN) {
+			if (evalFrom < cachedFrom) {
+				evaluator->evalDist(v, evalFrom, cachedFrom, kernelVector);
+			}
+			for (sample_id u = cachedFrom; u < i; u++) {
+				kernels[u] = views[mappings[backwardOrder[u]].cacheEntry].vector.data[original];
+			}
+			copied += i - cachedFrom;
+			evalFrom = i;
+		}
+	}
+	if (evalFrom < to) {
+		evaluator->evalDist(v, evalFrom, to, kernelVector);
+	}
+	filled += copied;
+	computed += (to - from) - copied;
 }
 
 /* Returns the worst violator (index and corresponding error), 
@@ -145,11 +232,11 @@ CWorstViolator CachedKernelEvaluator::findWorstViolator() {
  */
 void CachedKernelEvaluator::performSGDUpdate(sample_id worstViolator, fvalue gradient, fvalue biasGradient) {
 	// get kernel vector with respect to v
-	evalKernel(worstViolator, svnumber, currentSize, kernelVector);
+	fvalue *kernels = getKernelRow(worstViolator);
 
 	// update output
 	for (int i = svnumber; i < currentSize; i++) {
-		output[i] = output[i] + kernelVector->data[i] * gradient + biasGradient;
+		output[i] = output[i] + kernels[i] * gradient + biasGradient;
 	}
 
 	// update alphas
@@ -175,38 +262,21 @@ void CachedKernelEvaluator::swapSamples(sample_id u, sample_id v) {
 		listener->notify(u, v);
 	}
 
-	EntryMapping &vmap = mappings[v];
-	EntryMapping &umap = mappings[u];
-	entry_id temp = vmap.cacheEntry;
-	vmap.cacheEntry = umap.cacheEntry;
-	umap.cacheEntry = temp;
-
-	if (umap.cacheEntry != INVALID_ENTRY_ID) {
-		entries[umap.cacheEntry].mapping = u;
-	}
-	if (vmap.cacheEntry != INVALID_ENTRY_ID) {
-		entries[vmap.cacheEntry].mapping = v;
-	}
-
 	forwardOrder[backwardOrder[u]] = v;
 	forwardOrder[backwardOrder[v]] = u;
 	swap(backwardOrder[u], backwardOrder[v]);
+	swap(cachedRows[u], cachedRows[v]);
 }
 
 /* 
- * Resets the cache based on the current dimension.
- * Calls initalize when the cache dimension is found.
+ * Resets the model (the cached kernel rows stay valid).
  */
 void CachedKernelEvaluator::reset() {
-	CacheDimension dim = findCacheDimension(cacheSize, problemSize);
-	cacheLines = dim.lines;
-	cacheDepth = dim.depth;
-
 	initialize();
 }
 
 /* 
- * Initialize the cache. Allocates memory for the alphas, output values.
+ * Initialize the model. Resets the alphas, output values and the bias.
  */
 void CachedKernelEvaluator::initialize() {
 	// initialize alphas and kernel values
@@ -222,60 +292,73 @@ void CachedKernelEvaluator::initialize() {
 	// initialize buffer
 	fbufferView = fvector_subv(fbuffer, 0, svnumber);
 
-	// initialize vector views
-	quantity offset = 0;
-	for (quantity i = 0; i < cacheLines; i++) {
-		views[i] = fvectorv_array(cache + offset, cacheDepth);
-		views[i].vector.size = 0;
-		offset += cacheDepth;
-	}
+	evaluator->resetBias();
+}
 
-	// initialize cache mappings
-	fvector *initialVector = &views[INITIAL_ID].vector;
-	initialVector->size = 1;
-	mappings[INITIAL_ID].cacheEntry = INITIAL_ID;
+/*
+ * Fills the cache with the whole distance matrix, so no distance is evaluated
+ * while training. The kernel values of a row are then kept until gamma changes.
+ */
+void CachedKernelEvaluator::precomputeRows(quantity threads) {
+	evaluator->evalDistMatrix(cache, threads);
+	for (sample_id i = 0; i < problemSize; i++) {
+		mappings[i].cacheEntry = i;
+		entries[i].mapping = i;
+	}
+	usedLines = cacheLines;
+	cachedRows.assign(problemSize, 1);
+	kernelRows = new fvalue[(size_t) problemSize * problemSize];
+	kernelVersions = vector<quantity>(problemSize, 0);
+}
 
-	// initialize cache entries
-	for (entry_id i = INITIAL_ID; i < cacheLines; i++) {
-		CacheEntry &entry = entries[i];
-		entry.prev = i + 1;
-		entry.next = i - 1;
-		entry.vector = i;
-		entry.mapping = i;
-
-		EntryMapping &mapping = mappings[i];
-		mapping.cacheEntry = i;
+/*
+ * Drops all the cached rows.
+ */
+void CachedKernelEvaluator::clearRows() {
+	for (sample_id i = 0; i < problemSize; i++) {
+		mappings[i].cacheEntry = INVALID_ENTRY_ID;
 	}
-	for (entry_id i = cacheLines; i < problemSize; i++) {
-		EntryMapping &mapping = mappings[i];
-		mapping.cacheEntry = INVALID_ENTRY_ID;
+	for (entry_id i = 0; i < cacheLines; i++) {
+		entries[i].mapping = INVALID_SAMPLE_ID;
+		entries[i].uses = 0;
 	}
-	entries[cacheLines - 1].prev = INITIAL_ID;
-	entries[INITIAL_ID].next = cacheLines - 1;
-
-	lruEntry = cacheLines - 1;
-
-	evaluator->resetBias();
+	usedLines = 0;
+	cachedRows.assign(problemSize, 0);
 }
 
-CacheDimension CachedKernelEvaluator::findCacheDimension(
-		quantity cacheSize, quantity problemSize) {
-	CacheDimension dimension;
-	if (cacheSize / problemSize < problemSize) {
-		dimension.depth = max((quantity) INITIAL_CACHE_DEPTH, cacheSize / problemSize);
-		dimension.lines = min(cacheSize / dimension.depth, problemSize);
-	} else {
-		dimension.depth = problemSize;
-		dimension.lines = problemSize;
+/*
+ * Returns a free line or the first line not used lately (none of its uses left
+ * after halving them for every kernel parameters), or INVALID_ENTRY_ID
+ * if all the cached rows are still used. The same violators are selected in
+ * about the same order by every iteration of a training, so evicting rows used
+ * by the current training (least recently used ones included) would only make
+ * room for rows evicted before being used again. The scan is cheap compared to
+ * the evaluation of a row.
+ */
+entry_id CachedKernelEvaluator::findEvictedEntry() {
+	if (usedLines < cacheLines) {
+		return usedLines++;
 	}
-	return dimension;
+	for (entry_id i = 0; i < cacheLines; i++) {
+		if (entries[i].uses == 0) {
+			return i;
+		}
+	}
+	return INVALID_ENTRY_ID;
 }
 
 /*
- * Sets the current kernel parameters.
+ * Sets the current kernel parameters. The uses of the cached rows are halved,
+ * so the rows no longer used with the following parameters can be evicted.
  */
 void CachedKernelEvaluator::setKernelParams(fvalue c, CGaussKernel gparams) {
+	if (gparams.m_negativeGamma != evaluator->getParams().m_negativeGamma) {
+		gammaVersion++;
+	}
 	evaluator->setKernelParams(c, gparams);
+	for (entry_id i = 0; i < cacheLines; i++) {
+		entries[i].uses /= 2;
+	}
 	reset();
 }
 
@@ -284,15 +367,9 @@ void CachedKernelEvaluator::setKernelParams(fvalue c, CGaussKernel gparams) {
  * update it's location (which is now svnumber). Increment the number of support vectors and the alphas view size.
  */
 void CachedKernelEvaluator::performSvUpdate(sample_id& worstViolator) {
-	// TODO: have a look at what's going on here.
-	if (svnumber >= cacheDepth) {
-		resizeCache();
-	}
-	else {
-		// swap rows
-		swapSamples(worstViolator, svnumber);
-		worstViolator = svnumber;
-	}
+	// swap rows
+	swapSamples(worstViolator, svnumber);
+	worstViolator = svnumber;
 
 	// adjust sv number
 	svnumber++;
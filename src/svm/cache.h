@@ -34,10 +34,10 @@
 #define STATS(c)
 #endif
 
-#define CACHE_DENSITY_RATIO 0.1
-#define CACHE_DEPTH_INCREASE 1.5
-#define INITIAL_CACHE_DEPTH 256
-#define INITIAL_ID 0
+// shortest run of samples with cached rows whose distances are copied
+#define SYMMETRIC_FILL_RUN 32
+// distances are copied when at least 1 / SYMMETRIC_FILL_RATIO of them are cached
+#define SYMMETRIC_FILL_RATIO 4
 
 typedef sample_id row_id;
 
@@ -56,6 +56,21 @@ struct EntryMapping {
 
 };
 
+/*
+ * Cache line holding the row of a sample.
+ */
+struct CacheEntry {
+
+	sample_id mapping; // original id of the sample whose row is held
+	quantity uses; // lookups of the row, halved for every kernel parameters
+
+	CacheEntry() :
+		mapping(INVALID_SAMPLE_ID),
+		uses(0) {
+	}
+
+};
+
 /*
  * Worst violating vector structure that holds the index of the current worst violator and it's error.
  */
@@ -71,23 +86,6 @@ struct CWorstViolator {
 
 };
 
-struct CacheEntry {
-
-	entry_id prev;
-	entry_id next;
-
-	entry_id vector;
-	sample_id mapping;
-
-	CacheEntry() :
-		prev(INVALID_ENTRY_ID),
-		next(INVALID_ENTRY_ID),
-		vector(INVALID_ENTRY_ID),
-		mapping(INVALID_SAMPLE_ID) {
-	}
-
-};
-
 class SwapListener {
 
 public:
@@ -97,16 +95,14 @@ public:
 
 };
 
-
-struct CacheDimension {
-
-	quantity lines;
-	quantity depth;
-
-};
-
 /*
-Holds the current model. 
+Holds the current model. Squared distances of the worst violators to all the
+samples are cached by the original ids of the samples, so swapping samples does
+not touch them. They do not depend on C or gamma either, so a cached row serves
+the whole model selection (all folds, class pairs and candidate parameters)
+until the following trainings stop using it and it is evicted. When the cache
+can hold the distances and the kernel values of all the pairs of samples, the
+distances are computed at once before training.
 */
 class CachedKernelEvaluator {
 
@@ -117,27 +113,35 @@ class CachedKernelEvaluator {
 	fvectorv alphasView;
 	quantity svnumber;
 
-	fvector *kernelVector;
-
 	fvector *fbuffer;
 	fvectorv fbufferView;
 
 	quantity problemSize;
 	quantity currentSize;
 
-	quantity cacheSize;
-	quantity cacheLines;
-	quantity cacheDepth;
+	size_t cacheSize; // in values, may exceed the range of 'quantity'
+	quantity cacheLines; // rows of problemSize values
 	fvalue *cache;
+	fvector *kernelVector;
 
 	fvectorv *views;
 	vector<sample_id> forwardOrder;
 	vector<sample_id> backwardOrder;
 
-	EntryMapping *mappings;
+	EntryMapping *mappings; // by the original ids of the samples
 	CacheEntry *entries;
+	quantity usedLines;
+	vector<char> cachedRows; // whether the rows of the samples are cached
+	bool symmetric; // distances can be copied from the rows of other samples
+
+	fvalue *kernelRows; // NULL unless the distance matrix is precomputed
+	vector<quantity> kernelVersions; // gamma versions of the kernel rows
+	quantity gammaVersion;
 
-	entry_id lruEntry;
+	iteration lookups;
+	iteration hits;
+	iteration filled; // distances copied from the rows of other samples
+	iteration computed;
 
 	RbfKernelEvaluator *evaluator;
 	SolverStrategy *strategy;
@@ -145,15 +149,19 @@ class CachedKernelEvaluator {
 	SwapListener *listener;
 
 protected:
-	void initialize();
-	CacheDimension findCacheDimension(quantity maxSize, quantity problemSize);
+	static size_t getCacheSize(quantity probSize, quantity cchSize);
 
-	void resizeCache();
+	void initialize();
+	void clearRows();
+	entry_id findEvictedEntry();
+	void precomputeRows(quantity threads);
 
+	fvalue* getKernelRow(sample_id v);
+	void evalDistances(sample_id v, sample_id from, sample_id to);
 	void evalKernel(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector *result);
 
 public:
-	CachedKernelEvaluator(RbfKernelEvaluator *evaluator, SolverStrategy *strategy, quantity probSize, quantity cchSize, SwapListener *listener);
+	CachedKernelEvaluator(RbfKernelEvaluator *evaluator, SolverStrategy *strategy, quantity probSize, quantity cchSize, quantity threads, SwapListener *listener);
 	~CachedKernelEvaluator();
 
 	fvalue checkViolation(sample_id v);
@@ -186,6 +194,12 @@ public:
 	fvalue getBetta();
 	fvalue getEpochs();
 	fvalue getMargin();
+
+	quantity getCacheLines();
+	iteration getLookups();
+	iteration getHits();
+	iteration getFilled();
+	iteration getComputed();
 };
 
 /*
@@ -265,4 +279,29 @@ inline fvector* CachedKernelEvaluator::getBuffer() {
 }
 
 
+inline quantity CachedKernelEvaluator::getCacheLines() {
+	return cacheLines;
+}
+
+
+inline iteration CachedKernelEvaluator::getLookups() {
+	return lookups;
+}
+
+
+inline iteration CachedKernelEvaluator::getHits() {
+	return hits;
+}
+
+
+inline iteration CachedKernelEvaluator::getFilled() {
+	return filled;
+}
+
+
+inline iteration CachedKernelEvaluator::getComputed() {
+	return computed;
+}
+
+
 #endif
@@ -18,37 +18,157 @@
 
 #include "kernel.h"
 
+#include <atomic>
+#include <exception>
+#include <thread>
+
 CGaussKernel::CGaussKernel(fvalue gamma) :
 		m_negativeGamma(-gamma) {
 }
 
-RbfKernelEvaluator::RbfKernelEvaluator(sfmatrix* samples, label_id* labels, quantity classNumber, fvalue betta, fvalue c, CGaussKernel &params, fvalue epochs, fvalue margin) :
+RbfKernelEvaluator::RbfKernelEvaluator(sfmatrix* samples, label_id* labels, quantity classNumber, fvalue betta, fvalue c, CGaussKernel &params, fvalue epochs, fvalue margin, ExpAccuracy expAccuracy) :
   samples(samples),
   labels(labels),
   c(c),
   betta(betta),
   params(params),
-  eval(samples),
+  eval(MatrixEvaluator::create(samples)),
   epochs(epochs),
-  margin(margin) {
+  margin(margin),
+  expAccuracy(expAccuracy) {
   bias = 0.0;
   yyNeg = -1.0 / (classNumber - 1);
 }
 
 RbfKernelEvaluator::~RbfKernelEvaluator() {
+  delete eval;
 }
 
 void RbfKernelEvaluator::evalKernel(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* result)
 {
-  eval.dist(id, rangeFrom, rangeTo, result);
+  eval->dist(id, rangeFrom, rangeTo, result);
 
+  // the distances are still in the cache, exp of the row is computed at once
   fvalue* rptr = fvector_ptr(result);
-  for (sample_id iid = rangeFrom; iid < rangeTo; iid++) {
-    rptr[iid] = rbf(rptr[iid]);
-  }
+  applyKernel(rptr + rangeFrom, rangeTo - rangeFrom);
+}
+
+/*
+ * Squared euclidean distances of sample 'id' to the samples in range 'rangeFrom' to 'rangeTo'.
+ * They do not depend on the kernel parameters.
+ */
+void RbfKernelEvaluator::evalDist(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* result)
+{
+  eval->dist(id, rangeFrom, rangeTo, result);
+}
+
+/*
+ * Replaces 'count' squared distances by the kernel values for the current gamma.
+ */
+void RbfKernelEvaluator::applyKernel(fvalue* values, quantity count)
+{
+  scaledExp(params.m_negativeGamma, values, count, expAccuracy);
 }
 
 void RbfKernelEvaluator::setKernelParams(fvalue c, CGaussKernel &params) {
   this->c = c;
   this->params = params;
-}
\ No newline at end of file
+}
+
+/*
+ * Squared euclidean distances of all the pairs of samples, stored row by row in 'result'
+ * (height x height values). The matrix is split into square tiles: every row of a tile is
+ * evaluated against the columns of the tile, which stay in the processor cache. When the
+ * distances are symmetric to the last bit, only the tiles on and above the diagonal are
+ * evaluated and mirrored below it; otherwise every row is evaluated against all the columns,
+ * so that it equals the row evaluated on its own. Sparse samples are scattered to the
+ * workspace on every call, so their rows are evaluated against all the tiles of a row at
+ * once. The work is handed out to 'threads' threads (0 for all cores), each one with its
+ * own evaluator.
+ */
+void RbfKernelEvaluator::evalDistMatrix(fvalue* result, quantity threads)
+{
+  size_t height = samples->height;
+  bool symmetric = eval->isSymmetric();
+  quantity tiles = (quantity) ((height + DIST_TILE_SIZE - 1) / DIST_TILE_SIZE);
+  // column tiles evaluated at once
+  quantity span = samples->offsets == NULL ? 1 : max(tiles, (quantity) 1);
+  // tasks of a row of tiles (from the diagonal if mirrored)
+  auto rowTasks = [=](quantity row) {
+    return ((symmetric ? tiles - row : tiles) + span - 1) / span;
+  };
+  quantity tasks = 0;
+  for (quantity row = 0; row < tiles; row++) {
+    tasks += rowTasks(row);
+  }
+  if (threads == 0) {
+    threads = max(thread::hardware_concurrency(), 1u);
+  }
+  // out of core storages track the rows read, they cannot be shared
+  if (samples->storage && !samples->storage->isResident()) {
+    threads = 1;
+  }
+  threads = max(min(threads, tasks), (quantity) 1);
+
+  atomic<quantity> nextTask(0);
+  auto evalTiles = [&](MatrixEvaluator* evaluator) {
+    fvector* buffer = fvector_alloc(height);
+    fvalue* bptr = fvector_ptr(buffer);
+    for (quantity task = nextTask++; task < tasks; task = nextTask++) {
+      // tasks are numbered row by row
+      quantity row = 0;
+      quantity column = task;
+      while (column >= rowTasks(row)) {
+        column -= rowTasks(row);
+        row++;
+      }
+      column = (symmetric ? row : 0) + column * span;
+      sample_id rowFrom = row * DIST_TILE_SIZE;
+      sample_id rowTo = (sample_id) min((size_t) rowFrom + DIST_TILE_SIZE, height);
+      sample_id columnFrom = column * DIST_TILE_SIZE;
+      sample_id columnTo = (sample_id) min((size_t) columnFrom + span * DIST_TILE_SIZE, height);
+      for (sample_id u = rowFrom; u < rowTo; u++) {
+        sample_id from = symmetric ? max(u, columnFrom) : columnFrom;
+        if (from < columnTo) {
+          evaluator->dist(u, from, columnTo, buffer);
+          for (sample_id v = from; v < columnTo; v++) {
+            result[u * height + v] = bptr[v];
+          }
+          if (symmetric) {
+            for (sample_id v = from; v < columnTo; v++) {
+              result[v * height + u] = bptr[v];
+            }
+          }
+        }
+      }
+    }
+    fvector_free(buffer);
+  };
+
+  vector<exception_ptr> errors(threads);
+  vector<thread> workers;
+  for (quantity i = 1; i < threads; i++) {
+    workers.push_back(thread([&evalTiles, &errors, this, i]() {
+      try {
+        MatrixEvaluator* evaluator = eval->createWorker();
+        evalTiles(evaluator);
+        delete evaluator;
+      } catch (...) {
+        errors[i] = current_exception();
+      }
+    }));
+  }
+  try {
+    evalTiles(eval);
+  } catch (...) {
+    errors[0] = current_exception();
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+  for (size_t i = 0; i < errors.size(); i++) {
+    if (errors[i]) {
+      rethrow_exception(errors[i]);
+    }
+  }
+}
@@ -21,6 +21,10 @@
 
 #include "../math/numeric.h"
 #include "../math/matrix.h"
+#include "../math/exp.h"
+
+// rows (and columns) of the tiles of the distance matrix
+#define DIST_TILE_SIZE 256
 
 #define YY_POS 1.0
 #define YY_NEG(cl) (-1.0 / (cl - 1))
@@ -60,18 +64,23 @@ private:
 
 	fvalue epochs;
 	fvalue margin;
+	ExpAccuracy expAccuracy;
 
 protected:
   CGaussKernel params;
-	MatrixEvaluator eval;
+	MatrixEvaluator *eval;
 
 	fvalue rbf(fvalue dist2);
 
 public:
-	RbfKernelEvaluator(sfmatrix* samples, label_id* labels, quantity classNumber, fvalue bias, fvalue c, CGaussKernel &params, fvalue epochs, fvalue margin);
+	RbfKernelEvaluator(sfmatrix* samples, label_id* labels, quantity classNumber, fvalue bias, fvalue c, CGaussKernel &params, fvalue epochs, fvalue margin, ExpAccuracy expAccuracy);
 	~RbfKernelEvaluator();
 
 	void evalKernel(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* result);
+	void evalDist(sample_id id, sample_id rangeFrom, sample_id rangeTo, fvector* result);
+	void applyKernel(fvalue* values, quantity count);
+	void evalDistMatrix(fvalue* result, quantity threads);
+	bool isSymmetric();
 
 	void swapSamples(sample_id uid, sample_id vid);
 	void setKernelParams(fvalue c, CGaussKernel &params);
@@ -128,7 +137,11 @@ inline fvalue RbfKernelEvaluator::rbf(fvalue euclideanDistanceSquared) {
 
 inline void RbfKernelEvaluator::swapSamples(sample_id uid, sample_id vid) {
 	swap(labels[uid], labels[vid]);
-	eval.swapSamples(uid, vid);
+	eval->swapSamples(uid, vid);
+}
+
+inline bool RbfKernelEvaluator::isSymmetric() {
+	return eval->isSymmetric();
 }
 
 inline CGaussKernel RbfKernelEvaluator::getParams() {
@@ -154,6 +154,7 @@ void PairwiseSolver::train() {
 	for (it = state.models.begin(); it != state.models.end(); it++) {
 		pair<label_id, label_id> trainPair = it->trainingLabels;
 		quantity size = reorderSamples(this->labels, totalSize, trainPair);
+		this->samples->relayout();
 		this->cache->setLabel(trainPair);
 		this->setCurrentSize(size);
 		this->reset();
@@ -205,8 +206,8 @@ quantity PairwiseSolver::reorderSamples(label_id *labels, quantity size, pair<la
 
 CachedKernelEvaluator* PairwiseSolver::buildCache(fvalue c, CGaussKernel &gparams) {
 	fvalue bias = (this->params.bias == NO) ? 0.0 : 1.0;
-	RbfKernelEvaluator *rbf = new RbfKernelEvaluator(this->samples, this->labels, 2, bias, c, gparams, this->params.epochs, this->params.margin);
-	return new CachedKernelEvaluator(rbf, &this->strategy, this->size, this->params.cache.size, NULL);
+	RbfKernelEvaluator *rbf = new RbfKernelEvaluator(this->samples, this->labels, 2, bias, c, gparams, this->params.epochs, this->params.margin, this->params.expAccuracy);
+	return new CachedKernelEvaluator(rbf, &this->strategy, this->size, this->params.cache.size, this->params.threads, NULL);
 }
 
 
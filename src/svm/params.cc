@@ -25,4 +25,6 @@ TrainParams::TrainParams() {
 	generator.bucketNumber = DEFAULT_GENERATOR_BUCKET_NUMBER;
 	epochs = DEFAULT_EPOCHS;
 	margin = DEFAULT_MARGIN;
+	expAccuracy = EXACT_EXP;
+	threads = DEFAULT_THREADS;
 }
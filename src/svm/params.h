@@ -20,6 +20,7 @@
 #define PARAMS_H_
 
 #include "../math/numeric.h"
+#include "../math/exp.h"
 
 #define DEFAULT_ETA 1.0
 #define DEFAULT_DRAW_NUMBER 590
@@ -27,6 +28,8 @@
 #define DEFAULT_MARGIN 0.1
 
 #define DEFAULT_CACHE_SIZE 200
+// threads computing the distance matrix (0 for all cores)
+#define DEFAULT_THREADS 0
 
 #define DEFAULT_STOPPING_L1SVM_K 1.0
 
@@ -43,6 +46,8 @@ struct TrainParams {
 	BiasType bias;
 	fvalue epochs;
 	fvalue margin;
+	ExpAccuracy expAccuracy;
+	quantity threads;
 
 	struct {
 		quantity size;
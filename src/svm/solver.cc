@@ -75,8 +75,8 @@ void AbstractSolver::trainForCache(CachedKernelEvaluator *cache)
 
 CachedKernelEvaluator* AbstractSolver::buildCache(fvalue c, CGaussKernel &gparams) {
 	fvalue bias = (params.bias == NO) ? 0.0 : 1.0;
-	RbfKernelEvaluator *rbf = new RbfKernelEvaluator(this->samples, this->labels, (quantity) labelNames.size(), bias, c, gparams, params.epochs, params.margin);
-	return new CachedKernelEvaluator(rbf, &strategy, size, params.cache.size, NULL);
+	RbfKernelEvaluator *rbf = new RbfKernelEvaluator(this->samples, this->labels, (quantity) labelNames.size(), bias, c, gparams, params.epochs, params.margin, params.expAccuracy);
+	return new CachedKernelEvaluator(rbf, &strategy, size, params.cache.size, params.threads, NULL);
 }
 
 
@@ -85,6 +85,11 @@ sfmatrix* AbstractSolver::getSamples() {
 }
 
 
+CachedKernelEvaluator* AbstractSolver::getCache() {
+	return cache;
+}
+
+
 label_id* AbstractSolver::getLabels() {
 	return labels;
 }
@@ -131,6 +131,7 @@ public:
 	sfmatrix* getSamples();
 	label_id* getLabels();
 	map<label_id, string>& getLabelNames();
+	CachedKernelEvaluator* getCache();
 
 	quantity getSize();
 	virtual quantity getSvNumber();
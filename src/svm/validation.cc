@@ -94,6 +94,7 @@ void CrossValidationSolver::sortVectors(fold_id *membership, fold_id fold, quant
 			test--;
 		}
 	}
+	solver->getSamples()->relayout();
 }
 
 void CrossValidationSolver::resetInnerFold(fold_id fold) {
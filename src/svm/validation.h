@@ -111,6 +111,7 @@ public:
 	sfmatrix* getSamples();
 	label_id* getLabels();
 	map<label_id, string>& getLabelNames();
+	CachedKernelEvaluator* getCache();
 
 };
 
@@ -128,6 +129,11 @@ inline sfmatrix* CrossValidationSolver::getSamples() {
 }
 
 
+inline CachedKernelEvaluator* CrossValidationSolver::getCache() {
+	return solver->getCache();
+}
+
+
 inline label_id* CrossValidationSolver::getLabels() {
 	return solver->getLabels();
 }
@@ -26,6 +26,15 @@ void initOptions(vector<string> &arguments, bopt::variables_map& vars){
 		(PR_CACHE_SIZE, bopt::value<int>()->default_value(DEFAULT_CACHE_SIZE), "cache size (in MB)")
 		(PR_EPOCH, bopt::value<fvalue>()->default_value(0.5), "epochs number")
 		(PR_MARGIN, bopt::value<fvalue>()->default_value(0.1), "margin")
+		(PR_THREADS, bopt::value<int>()->default_value(DEFAULT_READ_THREADS), "input reading threads (0 for all cores)")
+		(PR_WRITE_BINARY, bopt::value<string>(), "save preprocessed data to binary file")
+		(PR_READ_BINARY, bopt::value<string>(), "load preprocessed data from binary file")
+		(PR_RESIDENT_MEMORY, bopt::value<int>()->default_value(DEFAULT_RESIDENT_MEMORY), "resident memory for preprocessed samples in MB (0 for no limit)")
+		(PR_MATRIX_TYPE, bopt::value<string>()->default_value(MATRIX_TYPE_AUTO), "sample storage (auto, sparse, dense, hybrid, binary)")
+		(PR_HASH_BITS, bopt::value<int>()->default_value(DEFAULT_HASH_BITS), "hash feature ids into 2^N columns (0 for no hashing)")
+		(PR_PRECISION, bopt::value<string>()->default_value(PRECISION_DOUBLE), "sample precision (double, mixed, float, half, bfloat16, int8)")
+		(PR_INDEX_ENCODING, bopt::value<string>()->default_value(INDEX_ENCODING_PLAIN), "feature id encoding (plain, delta)")
+		(PR_EXP_ACCURACY, bopt::value<string>()->default_value(EXP_ACCURACY_EXACT), "accuracy of the kernel exp (exact, precise, fast)")
 		(PR_INPUT, bopt::value<string>(), "input file");
 
 	bopt::positional_options_description opt;
@@ -131,4 +140,1176 @@ BOOST_AUTO_TEST_CASE( test_multiple_runs )
 
 	// test output with test example
 	BOOST_TEST(model_tree.get_child("classifier") == model_tree_two.get_child("classifier"));
-}
\ No newline at end of file
+}
+
+/*
+ * Builds a sparse matrix (in the layout of the solver) from dense rows.
+ */
+static sfmatrix* createSparseMatrix(vector<vector<fvalue> > &rows) {
+	vector<fvalue> values;
+	vector<feature_id> features;
+	vector<offset_id> offsets;
+	vector<quantity> lengths;
+	for (sample_id row = 0; row < rows.size(); row++) {
+		offsets.push_back(features.size());
+		for (feature_id feature = 0; feature < rows[row].size(); feature++) {
+			if (rows[row][feature] != 0.0) {
+				values.push_back(rows[row][feature]);
+				features.push_back(feature);
+			}
+		}
+		lengths.push_back(features.size() - offsets.back());
+		while (features.size() % SPARSE_ROW_ALIGNMENT != 0) {
+			values.push_back(0.0);
+			features.push_back(0);
+		}
+	}
+
+	fvalue *valuePtr = (fvalue*) allocateEntries(values.size(), sizeof(fvalue));
+	feature_id *featurePtr = (feature_id*) allocateEntries(features.size(), sizeof(feature_id));
+	offset_id *offsetPtr = new offset_id[offsets.size()];
+	quantity *lengthPtr = new quantity[lengths.size()];
+	copy(values.begin(), values.end(), valuePtr);
+	copy(features.begin(), features.end(), featurePtr);
+	copy(offsets.begin(), offsets.end(), offsetPtr);
+	copy(lengths.begin(), lengths.end(), lengthPtr);
+	return new sfmatrix(valuePtr, featurePtr, offsetPtr, lengthPtr, rows.size(), rows[0].size());
+}
+
+/*
+ * Expands the rows of a sparse matrix (in their current order) to dense rows.
+ */
+static vector<vector<fvalue> > expandRows(sfmatrix *matrix) {
+	vector<vector<fvalue> > rows(matrix->height, vector<fvalue>(matrix->width, 0.0));
+	for (sample_id row = 0; row < matrix->height; row++) {
+		for (offset_id i = matrix->offsets[row]; i < matrix->offsets[row] + matrix->lengths[row]; i++) {
+			rows[row][matrix->features[i]] = matrix->values[i];
+		}
+	}
+	return rows;
+}
+
+BOOST_AUTO_TEST_CASE( test_sparse_input )
+{
+	// tabs, CRLF, empty lines, explicit signs, zeros, unsorted and repeated ids
+	string fileName = TEST_TEMP_PATH "test_sparse_input.txt";
+	ofstream output(fileName.c_str(), ios::out | ios::binary);
+	output << "1 1:0.5 3:-2 7:1e-3\n";
+	output << "-1\t2:+4  5:0\r\n";
+	output << "\n";
+	output << "1 9:1.5 4:2.5 9:3\n";
+	output << "+1 1:1";
+	output.close();
+
+	// the mapped file is parsed straight into the padded CSR arrays
+	DataSet dataSet = SparseFormatDataSetFactory(fileName).createDataSet();
+	sfmatrix *matrix = dataSet.features;
+	BOOST_TEST(matrix->height == 4);
+	BOOST_TEST(matrix->width == 10);
+	label_id labels[] = { 0, 1, 0, 2 };
+	BOOST_TEST((dataSet.labels == vector<label_id>(labels, labels + 4)));
+	BOOST_TEST(dataSet.labelNames[0] == "1");
+	BOOST_TEST(dataSet.labelNames[1] == "-1");
+	BOOST_TEST(dataSet.labelNames[2] == "+1");
+
+	feature_id features[4][3] = { { 1, 3, 7 }, { 2 }, { 4, 9 }, { 1 } };
+	fvalue values[4][3] = { { 0.5, -2.0, 1e-3 }, { 4.0 }, { 2.5, 3.0 }, { 1.0 } };
+	quantity lengths[] = { 3, 1, 2, 1 };
+	offset_id offset = 0;
+	for (sample_id row = 0; row < 4; row++) {
+		BOOST_TEST(matrix->offsets[row] == offset);
+		BOOST_TEST(matrix->lengths[row] == lengths[row]);
+		for (quantity i = 0; i < lengths[row]; i++) {
+			BOOST_TEST(matrix->features[offset + i] == features[row][i]);
+			BOOST_TEST(matrix->values[offset + i] == values[row][i]);
+		}
+		for (offset_id i = lengths[row]; i < padRow(lengths[row]); i++) {
+			BOOST_TEST(matrix->values[offset + i] == 0.0);
+		}
+		offset += padRow(lengths[row]);
+	}
+	BOOST_TEST(dataSet.statistics.counts[1] == 2);
+	BOOST_TEST(dataSet.statistics.counts[5] == 0);
+	BOOST_TEST(dataSet.statistics.maxs[9] == 3.0);
+	delete matrix;
+
+	// malformed pairs are reported with their line
+	const char *invalid[] = { "1 1:0.5\n0 3:abc\n", "1 1:0.5\n0 3 4\n", "1 1:0.5 2:1x\n" };
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		output.open(fileName.c_str(), ios::out | ios::binary);
+		output << invalid[i];
+		output.close();
+		BOOST_CHECK_THROW(SparseFormatDataSetFactory(fileName).createDataSet(), invalid_data_format);
+	}
+	remove(fileName.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( test_parallel_parse )
+{
+	// large enough to be split into several chunks (unsorted rows and many labels)
+	string fileName = TEST_TEMP_PATH "test_parallel_parse.txt";
+	rng *generator = rng_alloc(gsl_rng_mt19937);
+	ofstream output(fileName.c_str());
+	for (sample_id row = 0; output.tellp() < 4 * MIN_CHUNK_SIZE; row++) {
+		output << "class" << rng_next_int(generator, 7);
+		for (feature_id feature = 60; feature > 0; feature--) {
+			if (rng_next_int(generator, 3) == 0) {
+				output << " " << feature << ":" << rng_next_int(generator, 1000) / 100.0 - 5.0;
+			}
+		}
+		output << "\n";
+	}
+	output.close();
+	rng_free(generator);
+
+	// the chunks parsed in parallel have to give exactly the serial result
+	InputParams params;
+	params.threads = 1;
+	DataSet serial = SparseFormatDataSetFactory(fileName, params).createDataSet();
+	params.threads = 4;
+	DataSet parallel = SparseFormatDataSetFactory(fileName, params).createDataSet();
+	BOOST_TEST(serial.features->height > 10000);
+	BOOST_TEST(parallel.features->height == serial.features->height);
+	BOOST_TEST(parallel.features->width == serial.features->width);
+	BOOST_TEST((parallel.labels == serial.labels));
+	BOOST_TEST((parallel.labelNames == serial.labelNames));
+	BOOST_TEST((expandRows(parallel.features) == expandRows(serial.features)));
+	BOOST_TEST((parallel.statistics.mins == serial.statistics.mins));
+	BOOST_TEST((parallel.statistics.maxs == serial.statistics.maxs));
+	BOOST_TEST((parallel.statistics.counts == serial.statistics.counts));
+	delete serial.features;
+	delete parallel.features;
+	remove(fileName.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_data )
+{
+	const quantity height = 200;
+	const quantity width = 40;
+	rng *generator = rng_alloc(gsl_rng_mt19937);
+	vector<vector<fvalue> > rows(height, vector<fvalue>(width, 0.0));
+	vector<label_id> labels(height);
+	for (sample_id row = 0; row < height; row++) {
+		for (feature_id feature = 0; feature < width; feature++) {
+			if (rng_next_int(generator, 3) == 0) {
+				rows[row][feature] = rng_next_int(generator, 1000) / 1000.0 - 0.5;
+			}
+		}
+		labels[row] = row % 3;
+	}
+	rng_free(generator);
+	map<label_id, string> labelNames;
+	labelNames[0] = "first";
+	labelNames[1] = "second";
+	labelNames[2] = "third";
+	DataSet dataSet(labelNames, labels, createSparseMatrix(rows));
+	for (feature_id feature = 0; feature < width + 5; feature++) {
+		dataSet.mappings.push_back(feature % 8 == 0 ? INVALID_FEATURE_ID : feature);
+	}
+
+	// the preprocessed file gives back the samples written to it
+	string fileName = TEST_TEMP_PATH "test_binary_data.bin";
+	BinaryDataSetWriter(fileName).write(dataSet);
+	DataSet loaded = BinaryDataSetFactory(fileName).createDataSet();
+	BOOST_TEST(loaded.features->height == height);
+	BOOST_TEST(loaded.features->width == width);
+	BOOST_TEST((loaded.labels == labels));
+	BOOST_TEST((loaded.labelNames == labelNames));
+	BOOST_TEST((loaded.mappings == dataSet.mappings));
+	BOOST_TEST((expandRows(loaded.features) == rows));
+	for (sample_id row = 0; row < height; row++) {
+		BOOST_TEST(loaded.features->norms[row] == dataSet.features->norms[row]);
+	}
+	delete loaded.features;
+
+	// out of core samples are read through a window far smaller than the data
+	loaded = BinaryDataSetFactory(fileName, 2048).createDataSet();
+	BOOST_TEST(!loaded.features->storage->isResident());
+	MatrixEvaluator *evaluator = MatrixEvaluator::create(loaded.features);
+	for (sample_id u = 0; u < height; u += 3) {
+		sample_id v = (u * 37) % height;
+		evaluator->swapSamples(u, v);
+		swap(rows[u], rows[v]);
+	}
+	fvector *buffer = fvector_alloc(height);
+	for (sample_id v = 0; v < height; v += 7) {
+		evaluator->dist(v, 0, height, buffer);
+		for (sample_id u = 0; u < height; u++) {
+			fvalue expected = 0.0;
+			for (feature_id feature = 0; feature < width; feature++) {
+				expected += pow2(rows[u][feature] - rows[v][feature]);
+			}
+			BOOST_TEST(fabs(fvector_get(buffer, u) - expected) <= 1e-12);
+		}
+	}
+	BOOST_TEST((expandRows(loaded.features) == rows));
+	fvector_free(buffer);
+	delete evaluator;
+	delete loaded.features;
+
+	// rows beyond the stored entries and features beyond the width are rejected
+	ifstream input(fileName.c_str(), ios::in | ios::binary);
+	string contents((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+	input.close();
+	BinaryHeader header;
+	memcpy(&header, contents.data(), sizeof(BinaryHeader));
+	offset_id rowOffset;
+	memcpy(&rowOffset, &contents[header.offsets + 5 * sizeof(offset_id)], sizeof(offset_id));
+	string corruptedName = TEST_TEMP_PATH "test_binary_corrupted.bin";
+	for (int corruption = 0; corruption < 2; corruption++) {
+		string corrupted = contents;
+		if (corruption == 0) {
+			offset_id offset = header.entries;
+			memcpy(&corrupted[header.offsets + 5 * sizeof(offset_id)], &offset, sizeof(offset_id));
+		} else {
+			feature_id feature = width;
+			memcpy(&corrupted[header.features + rowOffset * sizeof(feature_id)], &feature, sizeof(feature_id));
+		}
+		ofstream output(corruptedName.c_str(), ios::out | ios::binary);
+		output << corrupted;
+		output.close();
+		BOOST_CHECK_THROW(BinaryDataSetFactory(corruptedName).createDataSet(), runtime_error);
+		BOOST_CHECK_THROW(BinaryDataSetFactory(corruptedName, 2048).createDataSet(), runtime_error);
+	}
+	remove(corruptedName.c_str());
+
+	delete dataSet.features;
+	remove(fileName.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( test_compressed_input )
+{
+	// rows cross the boundaries of the decompressed blocks
+	string text;
+	rng *generator = rng_alloc(gsl_rng_mt19937);
+	while (text.size() < 3 * DECOMPRESSED_BLOCK_SIZE / 2) {
+		text += (format("%d") % rng_next_int(generator, 3)).str();
+		for (feature_id feature = 1; feature < 50; feature++) {
+			if (rng_next_int(generator, 4) == 0) {
+				text += (format(" %d:%g") % feature % (rng_next_int(generator, 1000) / 100.0)).str();
+			}
+		}
+		text += "\n";
+	}
+	rng_free(generator);
+	string plainName = TEST_TEMP_PATH "test_compressed_input.txt";
+	ofstream plain(plainName.c_str());
+	plain << text;
+	plain.close();
+	DataSet expected = SparseFormatDataSetFactory(plainName).createDataSet();
+
+	// compressed files are recognized by their contents and give the same samples
+	vector<string> fileNames;
+	fileNames.push_back(TEST_TEMP_PATH "test_compressed_input.gz");
+	gzFile gzip = gzopen(fileNames.back().c_str(), "wb");
+	BOOST_TEST(gzwrite(gzip, text.data(), (unsigned) text.size()) == (int) text.size());
+	gzclose(gzip);
+#ifdef HAVE_ZSTD
+	fileNames.push_back(TEST_TEMP_PATH "test_compressed_input.zst");
+	vector<char> compressed(ZSTD_compressBound(text.size()));
+	size_t size = ZSTD_compress(compressed.data(), compressed.size(), text.data(), text.size(), 3);
+	BOOST_TEST(!ZSTD_isError(size));
+	ofstream zstd(fileNames.back().c_str(), ios::out | ios::binary);
+	zstd.write(compressed.data(), size);
+	zstd.close();
+#endif
+	for (size_t i = 0; i < fileNames.size(); i++) {
+		DataSet dataSet = SparseFormatDataSetFactory(fileNames[i]).createDataSet();
+		BOOST_TEST((dataSet.labels == expected.labels));
+		BOOST_TEST((dataSet.labelNames == expected.labelNames));
+		BOOST_TEST((expandRows(dataSet.features) == expandRows(expected.features)));
+		BOOST_TEST((dataSet.statistics.counts == expected.statistics.counts));
+		delete dataSet.features;
+		remove(fileNames[i].c_str());
+	}
+	delete expected.features;
+	remove(plainName.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( test_dense_input )
+{
+	// the same samples in CSV and in libSVM format (column i is feature i)
+	const quantity height = 60;
+	const quantity width = 12;
+	string csvName = TEST_TEMP_PATH "test_dense_input.csv";
+	string headerName = TEST_TEMP_PATH "test_dense_header.csv";
+	string svmName = TEST_TEMP_PATH "test_dense_input.txt";
+	ofstream csv(csvName.c_str());
+	ofstream header(headerName.c_str());
+	ofstream svm(svmName.c_str());
+	header << "class";
+	for (feature_id feature = 1; feature <= width; feature++) {
+		header << ",x" << feature;
+	}
+	header << "\n";
+	rng *generator = rng_alloc(gsl_rng_mt19937);
+	for (sample_id row = 0; row < height; row++) {
+		string label = row % 3 == 0 ? "yes" : "no";
+		csv << label;
+		header << label;
+		svm << label;
+		for (feature_id feature = 1; feature <= width; feature++) {
+			fvalue value = rng_next_int(generator, 5) == 0 ? 0.0 : rng_next_int(generator, 1000) / 100.0 - 5.0;
+			csv << "," << value;
+			header << "," << value;
+			if (value != 0.0) {
+				svm << " " << feature << ":" << value;
+			}
+		}
+		csv << "\n";
+		header << "\n";
+		svm << "\n";
+	}
+	rng_free(generator);
+	csv.close();
+	header.close();
+	svm.close();
+
+	DataSet dataSet = SparseFormatDataSetFactory(csvName).createDataSet();
+	DataSet expected = SparseFormatDataSetFactory(svmName).createDataSet();
+	vector<vector<fvalue> > rows = expandRows(expected.features);
+	BOOST_TEST(dataSet.features->width == width + 1);
+	BOOST_TEST((dataSet.labels == expected.labels));
+	BOOST_TEST((dataSet.labelNames == expected.labelNames));
+	BOOST_TEST((expandRows(dataSet.features) == rows));
+
+	// a header line with column names is skipped
+	DataSet named = SparseFormatDataSetFactory(headerName).createDataSet();
+	BOOST_TEST((named.labels == expected.labels));
+	BOOST_TEST((named.labelNames == expected.labelNames));
+	BOOST_TEST((expandRows(named.features) == rows));
+	delete named.features;
+
+	// densified samples keep no sparse arrays and are evaluated as dense rows
+	FeatureMatrixBuilder builder;
+	sfmatrix *matrix = builder.densify(dataSet.features);
+	BOOST_TEST((matrix->dense != NULL));
+	BOOST_TEST((matrix->offsets == NULL));
+	for (sample_id row = 0; row < height; row++) {
+		BOOST_TEST((vector<fvalue>(matrix->dense->row(row), matrix->dense->row(row) + width + 1) == rows[row]));
+	}
+	MatrixEvaluator *evaluator = MatrixEvaluator::create(matrix);
+	fvector *buffer = fvector_alloc(height);
+	for (sample_id v = 0; v < height; v += 7) {
+		evaluator->dist(v, 0, height, buffer);
+		for (sample_id u = 0; u < height; u++) {
+			fvalue dist = 0.0;
+			for (feature_id feature = 0; feature <= width; feature++) {
+				dist += pow2(rows[u][feature] - rows[v][feature]);
+			}
+			BOOST_TEST(fabs(fvector_get(buffer, u) - dist) <= 1e-12);
+		}
+	}
+	fvector_free(buffer);
+	delete evaluator;
+	delete matrix;
+	delete expected.features;
+	remove(csvName.c_str());
+	remove(headerName.c_str());
+	remove(svmName.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( test_fixed_stride )
+{
+	// strides up to FIXED_STRIDE_LIMIT get their own evaluator, wider ones the generic one
+	const quantity height = 30;
+	const quantity widths[] = { 1, 4, 8, 13, 40, FIXED_STRIDE_LIMIT, FIXED_STRIDE_LIMIT + 3 };
+	rng *generator = rng_alloc(gsl_rng_mt19937);
+	FeatureMatrixBuilder builder;
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+		vector<vector<fvalue> > rows(height, vector<fvalue>(widths[w], 0.0));
+		for (sample_id row = 0; row < height; row++) {
+			for (feature_id feature = 0; feature < widths[w]; feature++) {
+				rows[row][feature] = rng_next_int(generator, 1000) / 500.0 - 1.0;
+			}
+		}
+		sfmatrix *matrix = builder.densify(createSparseMatrix(rows));
+		MatrixEvaluator *evaluator = MatrixEvaluator::create(matrix);
+		DenseMatrixEvaluator<fvalue, double> generic(matrix);
+		bool fixed = dynamic_cast<DenseMatrixEvaluator<fvalue, double>*>(evaluator) == NULL;
+		BOOST_TEST(fixed == (matrix->dense->stride <= FIXED_STRIDE_LIMIT));
+
+		// the fixed stride evaluator gives exactly the distances of the generic one
+		fvector *buffer = fvector_alloc(height);
+		fvector *expected = fvector_alloc(height);
+		for (sample_id v = 0; v < height; v++) {
+			evaluator->dist(v, 0, height, buffer);
+			generic.dist(v, 0, height, expected);
+			for (sample_id u = 0; u < height; u++) {
+				BOOST_TEST(fvector_get(buffer, u) == fvector_get(expected, u));
+				BOOST_TEST(evaluator->dot(u, v) == generic.dot(u, v));
+			}
+		}
+		fvector_free(buffer);
+		fvector_free(expected);
+		delete evaluator;
+		delete matrix;
+	}
+	rng_free(generator);
+}
+
+BOOST_AUTO_TEST_CASE( test_feature_hashing )
+{
+	// rows with single features reveal the column and sign of every feature
+	const quantity features = 40;
+	const quantity height = 200;
+	string fileName = TEST_TEMP_PATH "test_feature_hashing.txt";
+	ofstream output(fileName.c_str());
+	for (feature_id feature = 1; feature <= features; feature++) {
+		output << "0 " << feature << ":1\n";
+	}
+	vector<vector<pair<feature_id, fvalue> > > samples(height);
+	rng *generator = rng_alloc(gsl_rng_mt19937);
+	for (sample_id row = 0; row < height; row++) {
+		output << row % 2;
+		for (feature_id feature = 1; feature <= features; feature++) {
+			if (rng_next_int(generator, 4) == 0) {
+				// quarters are summed exactly when features collide
+				fvalue value = rng_next_int(generator, 40) / 4.0 - 5.0;
+				samples[row].push_back(make_pair(feature, value));
+				output << " " << feature << ":" << value;
+			}
+		}
+		output << "\n";
+	}
+	rng_free(generator);
+	output.close();
+
+	InputParams params;
+	params.hashBits = 4;
+	DataSet dataSet = SparseFormatDataSetFactory(fileName, params).createDataSet();
+	sfmatrix *matrix = dataSet.features;
+	BOOST_TEST(matrix->width <= 16);
+	vector<feature_id> columns(features + 1);
+	vector<fvalue> signs(features + 1);
+	for (feature_id feature = 1; feature <= features; feature++) {
+		offset_id offset = matrix->offsets[feature - 1];
+		BOOST_TEST(matrix->lengths[feature - 1] == 1);
+		columns[feature] = matrix->features[offset];
+		signs[feature] = matrix->values[offset];
+		BOOST_TEST(fabs(signs[feature]) == 1.0);
+	}
+
+	// colliding features are summed in their common column (rows stay sorted)
+	vector<vector<fvalue> > rows = expandRows(matrix);
+	for (sample_id row = 0; row < height; row++) {
+		vector<fvalue> expected(matrix->width, 0.0);
+		for (size_t i = 0; i < samples[row].size(); i++) {
+			feature_id feature = samples[row][i].first;
+			expected[columns[feature]] += signs[feature] * samples[row][i].second;
+		}
+		BOOST_TEST((rows[features + row] == expected));
+		feature_id *iptr = matrix->features + matrix->offsets[features + row];
+		for (quantity i = 1; i < matrix->lengths[features + row]; i++) {
+			BOOST_TEST(iptr[i - 1] < iptr[i]);
+		}
+	}
+
+	// statistics of the hashed columns are collected from the stored values
+	FeatureStatistics statistics;
+	statistics.collect(matrix);
+	BOOST_TEST(dataSet.statistics.counts.size() == matrix->width);
+	BOOST_TEST((dataSet.statistics.counts == statistics.counts));
+	BOOST_TEST((dataSet.statistics.mins == statistics.mins));
+	BOOST_TEST((dataSet.statistics.maxs == statistics.maxs));
+	delete matrix;
+	remove(fileName.c_str());
+}
+
+/*
+ * Gives access to the preprocessing steps of the solver factory.
+ */
+class SolverFactoryProbe: public BaseSolverFactory {
+
+public:
+	SolverFactoryProbe(string fileName, InputParams input = InputParams(), MatrixType matrixType = AUTO) :
+			BaseSolverFactory(fileName, TrainParams(), YOC, input, matrixType) {
+	}
+
+	using BaseSolverFactory::readDataSet;
+	using BaseSolverFactory::selectMatrixType;
+
+};
+
+BOOST_AUTO_TEST_CASE( test_feature_pruning )
+{
+	// feature 1 is present everywhere with one value, 3 is missing everywhere,
+	// 4 has a single value but is missing (zero) in some samples
+	string fileName = TEST_TEMP_PATH "test_feature_pruning.txt";
+	ofstream output(fileName.c_str());
+	output << "0 1:2 2:1 4:5 5:-4\n";
+	output << "1 1:2 2:-3\n";
+	output << "0 1:2 2:1.5 5:2\n";
+	output << "1 1:2 2:3 4:5\n";
+	output.close();
+
+	// statistics are collected while parsing
+	DataSet parsed = SparseFormatDataSetFactory(fileName).createDataSet();
+	FeatureStatistics &statistics = parsed.statistics;
+	BOOST_TEST(statistics.counts.size() == 6);
+	BOOST_TEST(statistics.counts[1] == 4);
+	BOOST_TEST(statistics.counts[3] == 0);
+	BOOST_TEST(statistics.mins[2] == -3.0);
+	BOOST_TEST(statistics.maxs[2] == 3.0);
+	BOOST_TEST(statistics.getScale(5) == 4.0);
+	BOOST_TEST(statistics.isConstant(0, 4));
+	BOOST_TEST(statistics.isConstant(1, 4));
+	BOOST_TEST(!statistics.isConstant(1, 5));
+	BOOST_TEST(!statistics.isConstant(2, 4));
+	BOOST_TEST(statistics.isConstant(3, 4));
+	BOOST_TEST(!statistics.isConstant(4, 4));
+	delete parsed.features;
+
+	// constant features are dropped, the rest renumbered and scaled in one pass
+	SolverFactoryProbe factory(fileName);
+	DataSet dataSet = factory.readDataSet();
+	feature_id mappings[] = { INVALID_FEATURE_ID, INVALID_FEATURE_ID, 0, INVALID_FEATURE_ID, 1, 2 };
+	BOOST_TEST((dataSet.mappings == vector<feature_id>(mappings, mappings + 6)));
+	BOOST_TEST(dataSet.features->width == 3);
+	vector<vector<fvalue> > rows(4, vector<fvalue>(3, 0.0));
+	rows[0][0] = 1.0 / 3.0;
+	rows[0][1] = 1.0;
+	rows[0][2] = -1.0;
+	rows[1][0] = -1.0;
+	rows[2][0] = 1.5 / 3.0;
+	rows[2][2] = 2.0 / 4.0;
+	rows[3][0] = 1.0;
+	rows[3][1] = 1.0;
+	BOOST_TEST((expandRows(dataSet.features) == rows));
+	for (sample_id row = 0; row < 4; row++) {
+		BOOST_TEST(dataSet.features->offsets[row] % SPARSE_ROW_ALIGNMENT == 0);
+	}
+	delete dataSet.features;
+	remove(fileName.c_str());
+}
+
+/*
+ * Storage selected automatically for the given rows.
+ */
+static MatrixType selectMatrixType(vector<vector<fvalue> > &rows) {
+	SolverFactoryProbe factory("");
+	sfmatrix *matrix = createSparseMatrix(rows);
+	vector<feature_id> denseColumns;
+	MatrixType type = factory.selectMatrixType(matrix, denseColumns);
+	delete matrix;
+	return type;
+}
+
+BOOST_AUTO_TEST_CASE( test_matrix_type )
+{
+	// dense storage from DENSE_MATRIX_DENSITY (12 of 16 values) on
+	vector<vector<fvalue> > rows(4, vector<fvalue>(4, 2.0));
+	rows[0][0] = rows[1][1] = rows[2][2] = rows[3][3] = 0.0;
+	BOOST_TEST(selectMatrixType(rows) == DENSE);
+	rows[0][1] = 0.0;
+	BOOST_TEST(selectMatrixType(rows) == HYBRID);
+
+	// hybrid storage if the columns filled to DENSE_COLUMN_FILL (4 of 8 rows)
+	// hold HYBRID_DENSE_SHARE of the entries
+	rows.assign(8, vector<fvalue>(16, 0.0));
+	for (sample_id row = 0; row < 4; row++) {
+		rows[row][0] = 2.0;
+		rows[row][row + 1] = 2.0;
+	}
+	BOOST_TEST(selectMatrixType(rows) == HYBRID);
+	rows[4][5] = 2.0;
+	BOOST_TEST(selectMatrixType(rows) == SPARSE);
+	rows[4][5] = 0.0;
+	rows[3][0] = 0.0;
+	BOOST_TEST(selectMatrixType(rows) == SPARSE);
+
+	// rows of bits if they take no more memory than the padded sparse rows
+	// (one 64-bit word per 64 columns against a padded entry of every row)
+	quantity words = padRow(1) * (sizeof(fvalue) + sizeof(feature_id)) / sizeof(uint64_t);
+	rows.assign(4, vector<fvalue>(words * BIT_WORD_SIZE, 0.0));
+	for (sample_id row = 0; row < 4; row++) {
+		rows[row][row] = 1.0;
+	}
+	BOOST_TEST(selectMatrixType(rows) == BINARY);
+	rows[3][3] = 2.0;
+	BOOST_TEST(selectMatrixType(rows) == SPARSE);
+	rows.assign(4, vector<fvalue>(words * BIT_WORD_SIZE + 1, 0.0));
+	for (sample_id row = 0; row < 4; row++) {
+		rows[row][row] = 1.0;
+	}
+	BOOST_TEST(selectMatrixType(rows) == SPARSE);
+
+	// requested storage is kept, binary one only for ones
+	rows[3][3] = 2.0;
+	SolverFactoryProbe factory("", InputParams(), DENSE);
+	sfmatrix *matrix = createSparseMatrix(rows);
+	vector<feature_id> denseColumns;
+	BOOST_TEST(factory.selectMatrixType(matrix, denseColumns) == DENSE);
+	SolverFactoryProbe binary("", InputParams(), BINARY);
+	BOOST_CHECK_THROW(binary.selectMatrixType(matrix, denseColumns), invalid_data_format);
+	delete matrix;
+}
+
+BOOST_AUTO_TEST_CASE( test_relayout )
+{
+	const quantity height = 100;
+	const quantity width = 30;
+	rng *generator = rng_alloc(gsl_rng_mt19937);
+	vector<vector<fvalue> > rows(height, vector<fvalue>(width, 0.0));
+	for (sample_id row = 0; row < height; row++) {
+		for (feature_id feature = 0; feature < width; feature++) {
+			if (rng_next_int(generator, row % 5 + 2) == 0) {
+				rows[row][feature] = rng_next_int(generator, 1000) / 1000.0 - 0.5;
+			}
+		}
+	}
+	rng_free(generator);
+	sfmatrix *matrix = createSparseMatrix(rows);
+	MatrixEvaluator *evaluator = MatrixEvaluator::create(matrix);
+	auto swapSamples = [&](sample_id u, sample_id v) {
+		evaluator->swapSamples(u, v);
+		swap(rows[u], rows[v]);
+	};
+
+	// a few scattered rows are left in place
+	swapSamples(3, 4);
+	BOOST_TEST(!matrix->relayout());
+	BOOST_TEST(matrix->relayouts == 0);
+
+	// the rows are copied in their current order, one after another
+	for (sample_id u = 0; u < height; u += 2) {
+		swapSamples(u, (u * 31 + 7) % height);
+	}
+	BOOST_TEST(matrix->relayout());
+	BOOST_TEST(matrix->relayouts == 1);
+	BOOST_TEST((expandRows(matrix) == rows));
+	for (sample_id row = 1; row < height; row++) {
+		BOOST_TEST(matrix->offsets[row] == matrix->offsets[row - 1] + padRow(matrix->lengths[row - 1]));
+	}
+	fvector *buffer = fvector_alloc(height);
+	for (sample_id v = 0; v < height; v += 7) {
+		evaluator->dist(v, 0, height, buffer);
+		for (sample_id u = 0; u < height; u++) {
+			fvalue expected = 0.0;
+			for (feature_id feature = 0; feature < width; feature++) {
+				expected += pow2(rows[u][feature] - rows[v][feature]);
+			}
+			BOOST_TEST(fabs(fvector_get(buffer, u) - expected) <= 1e-12);
+		}
+	}
+	fvector_free(buffer);
+	delete evaluator;
+	delete matrix;
+}
+
+BOOST_AUTO_TEST_CASE( test_sparse_dist )
+{
+	// random rows of various lengths (to cover the tails of the vector kernels)
+	const quantity height = 300;
+	const quantity width = 700;
+	rng *generator = rng_alloc(gsl_rng_mt19937);
+	vector<fvalue> values;
+	vector<feature_id> features;
+	vector<offset_id> offsets;
+	vector<quantity> lengths;
+	vector<vector<fvalue> > rows(height, vector<fvalue>(width, 0.0));
+	for (sample_id row = 0; row < height; row++) {
+		offsets.push_back(features.size());
+		quantity length = (quantity) rng_next_int(generator, 80);
+		lengths.push_back(length);
+		for (feature_id feature = 0; feature < width && length > 0; feature++) {
+			if (rng_next_int(generator, width - feature) < length) {
+				fvalue value = rng_next_int(generator, 1000) / 1000.0 - 0.5;
+				values.push_back(value);
+				features.push_back(feature);
+				rows[row][feature] = value;
+				length--;
+			}
+		}
+		while (features.size() % SPARSE_ROW_ALIGNMENT != 0) {
+			values.push_back(0.0);
+			features.push_back(0);
+		}
+	}
+	rng_free(generator);
+
+	fvalue *valuePtr = (fvalue*) allocateEntries(values.size(), sizeof(fvalue));
+	feature_id *featurePtr = (feature_id*) allocateEntries(features.size(), sizeof(feature_id));
+	offset_id *offsetPtr = new offset_id[offsets.size()];
+	quantity *lengthPtr = new quantity[lengths.size()];
+	copy(values.begin(), values.end(), valuePtr);
+	copy(features.begin(), features.end(), featurePtr);
+	copy(offsets.begin(), offsets.end(), offsetPtr);
+	copy(lengths.begin(), lengths.end(), lengthPtr);
+	sfmatrix matrix(valuePtr, featurePtr, offsetPtr, lengthPtr, height, width);
+
+	// distances computed by the evaluator have to match the direct ones
+	MatrixEvaluator *evaluator = MatrixEvaluator::create(&matrix);
+	fvector *buffer = fvector_alloc(height);
+	for (sample_id v = 0; v < height; v += 7) {
+		evaluator->dist(v, 0, height, buffer);
+		for (sample_id u = 0; u < height; u++) {
+			fvalue expected = 0.0;
+			for (feature_id feature = 0; feature < width; feature++) {
+				expected += pow2(rows[u][feature] - rows[v][feature]);
+			}
+			BOOST_TEST(fabs(fvector_get(buffer, u) - expected) <= 1e-6 * max(expected, (fvalue) 1.0));
+		}
+	}
+	delete evaluator;
+
+	// the inverted index has to follow reordered samples
+	evaluator = new InvertedIndexMatrixEvaluator<fvalue, double>(&matrix);
+	for (sample_id u = 0; u < height; u += 3) {
+		sample_id v = (u * 37) % height;
+		evaluator->swapSamples(u, v);
+		swap(rows[u], rows[v]);
+	}
+	for (sample_id v = 0; v < height; v += 7) {
+		evaluator->dist(v, 10, height - 10, buffer);
+		for (sample_id u = 10; u < height - 10; u++) {
+			fvalue expected = 0.0;
+			for (feature_id feature = 0; feature < width; feature++) {
+				expected += pow2(rows[u][feature] - rows[v][feature]);
+			}
+			BOOST_TEST(fabs(fvector_get(buffer, u) - expected) <= 1e-6 * max(expected, (fvalue) 1.0));
+		}
+	}
+	delete evaluator;
+
+	// narrowed samples only lose accuracy (the more, the shorter the encoding)
+	Precision precisions[] = { FLOAT_PRECISION, HALF_PRECISION, BFLOAT16_PRECISION, INT8_PRECISION };
+	fvalue tolerances[] = { 1e-4, 1e-3, 1e-2, 1e-2 };
+	for (size_t p = 0; p < sizeof(precisions) / sizeof(Precision); p++) {
+		sfmatrix *narrowed = createSparseMatrix(rows);
+		narrowed->narrow(precisions[p]);
+		BOOST_TEST(narrowed->precision == precisions[p]);
+		evaluator = MatrixEvaluator::create(narrowed);
+		for (sample_id v = 0; v < height; v += 7) {
+			evaluator->dist(v, 0, height, buffer);
+			for (sample_id u = 0; u < height; u++) {
+				fvalue expected = 0.0;
+				for (feature_id feature = 0; feature < width; feature++) {
+					expected += pow2(rows[u][feature] - rows[v][feature]);
+				}
+				BOOST_TEST(fabs(fvector_get(buffer, u) - expected) <= tolerances[p] * max(expected, (fvalue) 1.0));
+			}
+		}
+		delete evaluator;
+		delete narrowed;
+	}
+
+	// compressed feature ids have to follow reordered samples laid out again
+	sfmatrix *compressed = createSparseMatrix(rows);
+	compressed->compressIndices();
+	evaluator = new SparseMatrixEvaluator<fvalue, double>(compressed);
+	for (sample_id u = 0; u < height / 2; u += 2) {
+		evaluator->swapSamples(u, height - 1 - u);
+		swap(rows[u], rows[height - 1 - u]);
+	}
+	BOOST_TEST(compressed->relayout());
+	delete evaluator;
+	evaluator = new InvertedIndexMatrixEvaluator<fvalue, double>(compressed);
+	for (sample_id v = 0; v < height; v += 7) {
+		evaluator->dist(v, 0, height, buffer);
+		for (sample_id u = 0; u < height; u++) {
+			fvalue expected = 0.0;
+			for (feature_id feature = 0; feature < width; feature++) {
+				expected += pow2(rows[u][feature] - rows[v][feature]);
+			}
+			BOOST_TEST(fabs(fvector_get(buffer, u) - expected) <= 1e-6 * max(expected, (fvalue) 1.0));
+			BOOST_TEST(fabs(evaluator->dist(u, v) - expected) <= 1e-6 * max(expected, (fvalue) 1.0));
+		}
+	}
+	delete evaluator;
+	delete compressed;
+
+	// binary samples (the features of the rows above) stored as rows of bits
+	vector<vector<fvalue> > binaryRows(height, vector<fvalue>(width, 0.0));
+	for (sample_id u = 0; u < height; u++) {
+		for (feature_id feature = 0; feature < width; feature++) {
+			binaryRows[u][feature] = rows[u][feature] != 0.0 ? 1.0 : 0.0;
+		}
+	}
+	FeatureMatrixBuilder builder;
+	sfmatrix *binary = builder.binarize(createSparseMatrix(binaryRows));
+	evaluator = MatrixEvaluator::create(binary);
+	for (sample_id u = 0; u < height; u += 3) {
+		sample_id v = (u * 37) % height;
+		evaluator->swapSamples(u, v);
+		swap(binaryRows[u], binaryRows[v]);
+	}
+	for (sample_id v = 0; v < height; v += 7) {
+		evaluator->dist(v, 0, height, buffer);
+		for (sample_id u = 0; u < height; u++) {
+			fvalue expected = 0.0;
+			for (feature_id feature = 0; feature < width; feature++) {
+				expected += pow2(binaryRows[u][feature] - binaryRows[v][feature]);
+			}
+			BOOST_TEST(fvector_get(buffer, u) == expected);
+			BOOST_TEST(evaluator->dist(u, v) == expected);
+		}
+	}
+	fvector_free(buffer);
+	delete evaluator;
+	delete binary;
+}
+
+BOOST_AUTO_TEST_CASE( test_precision_accuracy )
+{
+	// compressed values cost little cross validation accuracy against doubles
+	const char *fileNames[] = { "small-data/heart2", "small-data/breast_cancer" };
+	Precision precisions[] = { FLOAT_PRECISION, HALF_PRECISION, BFLOAT16_PRECISION, INT8_PRECISION };
+	for (size_t i = 0; i < sizeof(fileNames) / sizeof(fileNames[0]); i++) {
+		fvalue reference = 0.0;
+		for (int p = -1; p < (int) (sizeof(precisions) / sizeof(precisions[0])); p++) {
+			InputParams input;
+			input.precision = p < 0 ? DOUBLE_PRECISION : precisions[p];
+			BaseSolverFactory factory(fileNames[i], TrainParams(), YOC, input, SPARSE);
+			CrossValidationSolver *solver = factory.getCrossValidationSolver(5, 1);
+			BOOST_TEST(factory.getPrecision() == input.precision);
+			CGaussKernel kernel(0.5);
+			solver->setKernelParams(1.0, kernel);
+			fvalue accuracy = solver->doCrossValidation().accuracy;
+			BOOST_TEST_MESSAGE(fileNames[i] << ", precision " << getPrecisionName(input.precision)
+					<< ": accuracy " << accuracy << ", largest value error " << factory.getPrecisionError());
+			if (p < 0) {
+				reference = accuracy;
+			} else {
+				BOOST_TEST(fabs(accuracy - reference) <= 0.03);
+			}
+			delete solver;
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE( test_scaled_exp )
+{
+	// arguments from underflow to slightly above zero (including the vector tails)
+	vector<fvalue> distances;
+	for (fvalue distance = -0.01; distance < 800.0; distance += 0.37) {
+		distances.push_back(distance);
+	}
+	ExpAccuracy accuracies[] = { EXACT_EXP, PRECISE_EXP, FAST_EXP };
+	fvalue tolerances[] = { 0.0, 1e-8, 1e-4 };
+	for (size_t a = 0; a < sizeof(accuracies) / sizeof(ExpAccuracy); a++) {
+		vector<fvalue> values(distances);
+		scaledExp(-1.0, values.data(), values.size(), accuracies[a]);
+		for (size_t i = 0; i < values.size(); i++) {
+			fvalue expected = exp(-distances[i]);
+			if (-distances[i] < EXP_UNDERFLOW) {
+				BOOST_TEST(values[i] <= expected);
+			} else {
+				BOOST_TEST(fabs(values[i] - expected) <= tolerances[a] * expected);
+			}
+		}
+	}
+}
+
+/*
+ * Exposes the kernel rows of the cache.
+ */
+class KernelRowCache: public CachedKernelEvaluator {
+
+public:
+	KernelRowCache(RbfKernelEvaluator *evaluator, SolverStrategy *strategy, quantity probSize, quantity cchSize) :
+			CachedKernelEvaluator(evaluator, strategy, probSize, cchSize, 2, NULL) {
+	}
+
+	using CachedKernelEvaluator::getCacheSize;
+	using CachedKernelEvaluator::getKernelRow;
+
+};
+
+BOOST_AUTO_TEST_CASE( test_kernel_cache )
+{
+	const quantity height = 40;
+	const quantity width = 6;
+	rng *generator = rng_alloc(gsl_rng_mt19937);
+	vector<vector<fvalue> > rows(height, vector<fvalue>(width, 0.0));
+	label_id labels[height];
+	for (sample_id row = 0; row < height; row++) {
+		for (feature_id feature = 0; feature < width; feature++) {
+			rows[row][feature] = rng_next_int(generator, 1000) / 1000.0;
+		}
+		labels[row] = row % 2;
+	}
+	rng_free(generator);
+	sfmatrix *matrix = createSparseMatrix(rows);
+
+	TrainParams params;
+	CGaussKernel gparams(0.5);
+	SolverStrategy strategy(params, 2, labels, height);
+	RbfKernelEvaluator *evaluator = new RbfKernelEvaluator(matrix, labels, 2, 0.0, 1.0, gparams,
+			params.epochs, params.margin, EXACT_EXP);
+	// with the smallest size the cache holds two rows
+	KernelRowCache cache(evaluator, &strategy, height, 0);
+	BOOST_TEST(cache.getCacheLines() == 2);
+
+	// rows have to follow the samples swapped since they were computed
+	auto checkRow = [&](sample_id v, sample_id from, sample_id to) {
+		fvalue *row = cache.getKernelRow(v);
+		for (sample_id u = from; u < to; u++) {
+			fvalue dist = 0.0;
+			for (feature_id feature = 0; feature < width; feature++) {
+				dist += pow2(rows[u][feature] - rows[v][feature]);
+			}
+			BOOST_TEST(fabs(row[u] - cache.getParams().m_evaluateKernel(dist)) <= 1e-12);
+		}
+	};
+	auto swapSamples = [&](sample_id u, sample_id v) {
+		cache.swapSamples(u, v);
+		swap(rows[u], rows[v]);
+	};
+
+	// rows are kept in the original order of the samples
+	cache.setCurrentSize(height);
+	checkRow(7, 1, height);
+	checkRow(7, 1, height);
+	BOOST_TEST(cache.getHits() == 1);
+	sample_id violator = 7;
+	cache.performSvUpdate(violator);
+	swap(rows[7], rows[1]);
+	swapSamples(20, 30);
+	checkRow(1, 2, height);
+	BOOST_TEST(cache.getHits() == 2);
+
+	// rows cover the samples outside of the current training too
+	cache.setCurrentSize(30);
+	checkRow(12, 2, 30);
+	swapSamples(29, 35);
+	swapSamples(15, 36);
+	checkRow(12, 2, 30);
+	BOOST_TEST(cache.getHits() == 3);
+
+	// a full cache does not replace the rows in use
+	checkRow(10, 2, 30);
+	checkRow(10, 2, 30);
+	checkRow(1, 2, 30);
+	BOOST_TEST(cache.getHits() == 4);
+
+	// the rows outlive the model and serve other kernel parameters
+	cache.reset();
+	checkRow(12, 1, 30);
+	BOOST_TEST(cache.getHits() == 5);
+	cache.setKernelParams(1.0, CGaussKernel(0.25));
+	checkRow(12, 1, 30);
+	checkRow(1, 1, 30);
+	checkRow(10, 1, 30);
+	BOOST_TEST(cache.getHits() == 7);
+
+	// a row not used with the last kernel parameters is replaced
+	cache.setKernelParams(1.0, CGaussKernel(0.5));
+	checkRow(1, 1, 30);
+	cache.setKernelParams(1.0, CGaussKernel(0.25));
+	checkRow(10, 1, 30);
+	checkRow(10, 1, 30);
+	checkRow(12, 1, 30);
+	checkRow(1, 1, 30);
+	BOOST_TEST(cache.getHits() == 10);
+	BOOST_TEST(cache.getLookups() == 17);
+	delete matrix;
+}
+
+BOOST_AUTO_TEST_CASE( test_kernel_params )
+{
+	const quantity height = 120;
+	const quantity width = 6;
+	rng *generator = rng_alloc(gsl_rng_mt19937);
+	vector<vector<fvalue> > rows(height, vector<fvalue>(width, 0.0));
+	label_id labels[height];
+	for (sample_id row = 0; row < height; row++) {
+		for (feature_id feature = 0; feature < width; feature++) {
+			rows[row][feature] = rng_next_int(generator, 1000) / 1000.0 - 0.5;
+		}
+		labels[row] = row % 2;
+	}
+	rng_free(generator);
+
+	TrainParams params;
+	CGaussKernel gparams(0.5);
+	SolverStrategy strategy(params, 2, labels, height);
+	FeatureMatrixBuilder builder;
+	vector<fvalue> gammas = { 2.0, 0.125, 0.5 };
+
+	// rows cached under one gamma give the exact kernel values of the following ones,
+	// with the whole distance matrix precomputed (2 MB) and with two cached rows (0 MB)
+	quantity cacheSizes[] = { 2, 0 };
+	for (bool dense : { false, true }) {
+		for (quantity cacheSize : cacheSizes) {
+			sfmatrix *samples = createSparseMatrix(rows);
+			sfmatrix *referenceSamples = createSparseMatrix(rows);
+			if (dense) {
+				samples = builder.densify(samples);
+				referenceSamples = builder.densify(referenceSamples);
+			}
+			RbfKernelEvaluator reference(referenceSamples, labels, 2, 0.0, 1.0, gparams,
+					params.epochs, params.margin, EXACT_EXP);
+			RbfKernelEvaluator *evaluator = new RbfKernelEvaluator(samples, labels, 2, 0.0, 1.0, gparams,
+					params.epochs, params.margin, EXACT_EXP);
+			KernelRowCache cache(evaluator, &strategy, height, cacheSize);
+			cache.setCurrentSize(height);
+			cache.getKernelRow(7);
+			cache.getKernelRow(30);
+			sample_id violator = 7;
+			cache.performSvUpdate(violator);
+			cache.swapSamples(30, 55);
+
+			fvector *buffer = fvector_alloc(height);
+			quantity mismatches = 0;
+			for (fvalue gamma : gammas) {
+				cache.setKernelParams(1.0, CGaussKernel(gamma));
+				for (sample_id original : { 7, 30 }) {
+					fvalue *row = cache.getKernelRow(cache.getForwardOrder()[original]);
+					reference.evalDist(original, 0, height, buffer);
+					for (sample_id u = cache.getSVNumber(); u < height; u++) {
+						fvalue dist = fvector_get(buffer, cache.getBackwardOrder()[u]);
+						mismatches += row[u] != cache.getParams().m_evaluateKernel(dist);
+					}
+				}
+			}
+			fvector_free(buffer);
+			BOOST_TEST(mismatches == 0);
+			BOOST_TEST(cache.getHits() == cache.getLookups() - (cacheSize > 0 ? 0 : 2));
+			delete samples;
+			delete referenceSamples;
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE( test_large_offsets )
+{
+	// entry offsets go beyond the 32-bit range
+#ifdef LARGE_DATA
+	BOOST_TEST(sizeof(offset_id) == sizeof(uint64_t));
+	offset_id large = (offset_id) 1 << 32;
+	BOOST_TEST(padRow(large) == large);
+	BOOST_TEST(padRow(large + 1) == large + SPARSE_ROW_ALIGNMENT);
+#endif
+
+	// a cache of 32 GB holds more values than a 32-bit size can count
+	size_t size = KernelRowCache::getCacheSize(100000, 32 * 1024);
+	BOOST_TEST(size == ((size_t) 32 << 30) / sizeof(fvalue));
+	BOOST_TEST(size > (size_t) UINT_MAX);
+	BOOST_TEST(KernelRowCache::getCacheSize(100000, 0) == (size_t) 200000);
+}
+
+BOOST_AUTO_TEST_CASE( test_dist_matrix )
+{
+	// more than one row of tiles, the last ones cut short
+	const quantity height = DIST_TILE_SIZE + 50;
+	const quantity width = 5;
+	rng *generator = rng_alloc(gsl_rng_mt19937);
+	vector<vector<fvalue> > rows(height, vector<fvalue>(width, 0.0));
+	label_id labels[height];
+	for (sample_id row = 0; row < height; row++) {
+		for (feature_id feature = 0; feature < width; feature++) {
+			rows[row][feature] = rng_next_int(generator, 1000) / 1000.0;
+		}
+		labels[row] = row % 2;
+	}
+	rng_free(generator);
+	sfmatrix *matrix = createSparseMatrix(rows);
+
+	TrainParams params;
+	CGaussKernel gparams(0.5);
+	RbfKernelEvaluator *evaluator = new RbfKernelEvaluator(matrix, labels, 2, 0.0, 1.0, gparams,
+			params.epochs, params.margin, EXACT_EXP);
+	vector<fvalue> dists((size_t) height * height);
+	evaluator->evalDistMatrix(dists.data(), 3);
+	for (sample_id u = 0; u < height; u++) {
+		for (sample_id v = 0; v < height; v++) {
+			fvalue dist = 0.0;
+			for (feature_id feature = 0; feature < width; feature++) {
+				dist += pow2(rows[u][feature] - rows[v][feature]);
+			}
+			BOOST_TEST(fabs(dists[(size_t) u * height + v] - dist) <= 1e-12);
+		}
+	}
+
+	// every row has to equal the row evaluated on its own (mirrored ones too),
+	// all the evaluators give symmetric distances
+	auto checkRows = [&](sfmatrix *samples) {
+		RbfKernelEvaluator kernel(samples, labels, 2, 0.0, 1.0, gparams,
+				params.epochs, params.margin, EXACT_EXP);
+		BOOST_TEST(kernel.isSymmetric());
+		vector<fvalue> matrix((size_t) height * height);
+		kernel.evalDistMatrix(matrix.data(), 3);
+		fvector *buffer = fvector_alloc(height);
+		quantity mismatches = 0;
+		quantity asymmetric = 0;
+		for (sample_id u = 0; u < height; u++) {
+			kernel.evalDist(u, 0, height, buffer);
+			for (sample_id v = 0; v < height; v++) {
+				mismatches += matrix[(size_t) u * height + v] != fvector_get(buffer, v);
+				asymmetric += matrix[(size_t) u * height + v] != matrix[(size_t) v * height + u];
+			}
+		}
+		fvector_free(buffer);
+		BOOST_TEST(mismatches == 0);
+		BOOST_TEST(asymmetric == 0);
+	};
+	vector<vector<fvalue> > sparseRows(height, vector<fvalue>(1000, 0.0));
+	vector<vector<fvalue> > binaryRows(height, vector<fvalue>(1000, 0.0));
+	vector<vector<fvalue> > longRows(height, vector<fvalue>(100, 0.0));
+	generator = rng_alloc(gsl_rng_mt19937);
+	for (sample_id row = 0; row < height; row++) {
+		for (quantity i = 0; i < 5; i++) {
+			feature_id feature = (feature_id) rng_next_int(generator, 1000);
+			sparseRows[row][feature] = rng_next_int(generator, 1000) / 1000.0 - 0.5;
+			binaryRows[row][feature] = 1.0;
+		}
+		// rows of several vectors, partly overlapping
+		for (quantity i = 0; i < 40; i++) {
+			feature_id feature = (feature_id) rng_next_int(generator, 100);
+			longRows[row][feature] = rng_next_int(generator, 1000) / 1000.0 - 0.5;
+		}
+	}
+	rng_free(generator);
+	FeatureMatrixBuilder builder;
+	sfmatrix *samples[] = { createSparseMatrix(rows), builder.densify(createSparseMatrix(rows)),
+			createSparseMatrix(sparseRows), builder.binarize(createSparseMatrix(binaryRows)),
+			createSparseMatrix(longRows) };
+	for (size_t i = 0; i < sizeof(samples) / sizeof(sfmatrix*); i++) {
+		checkRows(samples[i]);
+		delete samples[i];
+	}
+
+	// the distances and kernel values of all the pairs fit in 2 MB
+	SolverStrategy strategy(params, 2, labels, height);
+	KernelRowCache cache(evaluator, &strategy, height, 2);
+	cache.setCurrentSize(height);
+	for (fvalue gamma = 0.5; gamma <= 2.0; gamma *= 2.0) {
+		cache.setKernelParams(1.0, CGaussKernel(gamma));
+		for (sample_id v = 1; v < height; v += 50) {
+			fvalue *row = cache.getKernelRow(v);
+			for (sample_id u = 1; u < height; u++) {
+				fvalue kernel = cache.getParams().m_evaluateKernel(dists[(size_t) u * height + v]);
+				BOOST_TEST(fabs(row[u] - kernel) <= 1e-12);
+			}
+		}
+	}
+	BOOST_TEST(cache.getHits() == cache.getLookups());
+
+	// rows of dense and sparse samples are filled in from the rows of the samples
+	// cached before, the same as evaluated on their own
+	sfmatrix *denseMatrix = builder.densify(createSparseMatrix(rows));
+	for (sfmatrix *samples : { denseMatrix, matrix }) {
+		RbfKernelEvaluator reference(samples, labels, 2, 0.0, 1.0, gparams,
+				params.epochs, params.margin, EXACT_EXP);
+		evaluator = new RbfKernelEvaluator(samples, labels, 2, 0.0, 1.0, gparams,
+				params.epochs, params.margin, EXACT_EXP);
+		KernelRowCache rowCache(evaluator, &strategy, height, 1);
+		rowCache.setCurrentSize(height);
+		fvector *buffer = fvector_alloc(height);
+		quantity mismatches = 0;
+		for (sample_id v = 1; v < height; v++) {
+			fvalue *row = rowCache.getKernelRow(v);
+			reference.evalDist(v, 0, height, buffer);
+			for (sample_id u = 1; u < height; u++) {
+				mismatches += row[u] != rowCache.getParams().m_evaluateKernel(fvector_get(buffer, u));
+			}
+		}
+		fvector_free(buffer);
+		BOOST_TEST(mismatches == 0);
+		BOOST_TEST(rowCache.getFilled() > 0);
+		BOOST_TEST(rowCache.getFilled() + rowCache.getComputed() == (iteration) (height - 1) * height);
+	}
+	delete denseMatrix;
+	delete matrix;
+}
@@ -12,12 +12,17 @@
 #include <boost/foreach.hpp>
 
 #include <stdarg.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #include "../src/configuration.h"
 #include "../src/launcher.h"
 
 #define MAX_SIZE 255
 #define TEST_EXAMPLE_PATH "test/examples/"
+#define TEST_TEMP_PATH "test/bin/"
 
 typedef const char* LPCSTR;
 